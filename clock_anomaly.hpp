@@ -0,0 +1,198 @@
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// Class clock_anomaly: Online anomaly detector over the statistics periods of every client.
+//                      Keeps robust baselines (median and MAD of the last period medians and of
+//                      the last period spreads) and the expected reply count of each client, and
+//                      raises alerts for offset spikes, step changes, reply count drops and
+//                      clients that stop replying. The baselines are kept by the caller (one
+//                      per client slot); no history of samples is retained.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+// Alert kinds
+enum ClockAlertKind
+{
+     ALERT_OUTLIER = 0,  // period extremes far outside the usual spread (value: spread, us)
+     ALERT_STEP,         // period median far from the baseline median (value: median, us)
+     ALERT_COUNT_DROP,   // fewer than half the expected replies (value: count)
+     ALERT_SILENT        // no reply in a period (value: 0)
+};
+
+// Alert of a client in a period: observed value, baseline and robust scale of the baseline
+struct ClockAlert
+{
+       uint32_t       server_id;
+       uint32_t       clock_id;
+       ClockAlertKind kind;
+       int64_t        value;
+       int64_t        baseline;
+       int64_t        scale;
+};
+
+// Get the name of an alert kind
+const char* GetAlertName (ClockAlertKind pKind)
+{
+     switch (pKind)
+     {
+          case ALERT_OUTLIER:    return "outlier";
+          case ALERT_STEP:       return "step";
+          case ALERT_COUNT_DROP: return "count-drop";
+          case ALERT_SILENT:     return "silent";
+     }
+
+     return "unknown";
+}
+
+class clock_anomaly
+{
+        // Declare the number of periods in a baseline and the periods needed before alerting
+        enum { baseline_periods = 16, warmup_periods = 4 };
+
+        // Declare the smallest robust scale (microseconds; quiet clients have a MAD near zero)
+        enum { min_scale = 20 };
+
+public:
+
+        // Declare the baseline of a client: the client (server clock and client id), last period
+        // medians and spreads (circular), the expected reply count (smoothed) and the last period it
+        // replied in (0 unused)
+        struct clock_baseline
+        {
+               uint32_t server_id {0};
+               uint32_t clock_id {0};
+               int64_t medians[baseline_periods];
+               int64_t spreads[baseline_periods];
+               uint32_t next {0};
+               uint32_t count {0};
+               double expected {0};
+               uint64_t last_period {0};
+        };
+
+private:
+
+        // Declare the alert threshold (robust standard deviations) and the period number
+        double threshold;
+        uint64_t period {1};
+
+public:
+
+        // Constructor
+        clock_anomaly (double pThreshold = 6.0) : threshold(pThreshold) {}
+
+        // Check the summary of a client in this period (clients with replies) against its baseline poBase
+        // (a baseline left by another client is started afresh); alerts are appended to poAlerts
+        void Check (clock_baseline & poBase, uint32_t pServerID, uint32_t pClockID, uint64_t piCount, int64_t pMin, int64_t pMedian, int64_t pMax, vector<ClockAlert> & poAlerts)
+        {
+             clock_baseline & base = poBase;
+             if (base.server_id != pServerID || base.clock_id != pClockID)
+             {
+                 base = clock_baseline();
+                 base.server_id = pServerID;
+                 base.clock_id  = pClockID;
+             }
+             int64_t spread = max(pMax - pMedian, pMedian - pMin);
+             base.last_period = period;
+
+             // Learn the first periods of a client before judging it
+             if (base.count < warmup_periods)
+             {
+                 Learn(base, pMedian, spread, piCount);
+                 return;
+             }
+
+             int64_t median_base, median_scale, spread_base, spread_scale;
+             GetBaseline(base.medians, base.count, median_base, median_scale);
+             GetBaseline(base.spreads, base.count, spread_base, spread_scale);
+
+             // Step change: the median itself moved (a spike moves the extremes, not the median)
+             bool step = llabs(pMedian - median_base) > threshold * median_scale;
+             if (step)
+             {
+                 poAlerts.push_back({pServerID, pClockID, ALERT_STEP, pMedian, median_base, median_scale});
+                 base.count = 0;
+             }
+
+             // Spike: the extremes of the period went far beyond the usual spread
+             bool outlier = spread - spread_base > threshold * spread_scale;
+             if (outlier)
+             {
+                 poAlerts.push_back({pServerID, pClockID, ALERT_OUTLIER, spread, spread_base, spread_scale});
+             }
+
+             // Reply count drop
+             if (piCount < base.expected / 2)
+             {
+                 poAlerts.push_back({pServerID, pClockID, ALERT_COUNT_DROP, static_cast<int64_t>(piCount), static_cast<int64_t>(base.expected), 0});
+             }
+
+             // Keep spikes out of the spread baseline (a step restarts the baseline from this period)
+             Learn(base, pMedian, outlier && !step ? spread_base : spread, piCount);
+        }
+
+        // Check a client that did not reply in this period: it is reported once (if its baseline was
+        // complete) and forgotten
+        void CheckSilent (clock_baseline & poBase, vector<ClockAlert> & poAlerts)
+        {
+             if (poBase.last_period == 0 || poBase.last_period == period)
+             {
+                 return;
+             }
+
+             if (poBase.count >= warmup_periods)
+             {
+                 poAlerts.push_back({poBase.server_id, poBase.clock_id, ALERT_SILENT, 0, static_cast<int64_t>(poBase.expected), 0});
+             }
+             poBase = clock_baseline();
+        }
+
+        // Close the period (after every client has been checked)
+        void EndPeriod ()
+        {
+             period++;
+        }
+
+private:
+
+        // Add a period to the baseline of a client
+        static void Learn (clock_baseline & base, int64_t pMedian, int64_t pSpread, uint64_t piCount)
+        {
+             if (base.count == 0)
+             {
+                 base.next = 0;
+             }
+
+             base.medians[base.next] = pMedian;
+             base.spreads[base.next] = pSpread;
+             base.next  = (base.next + 1) % baseline_periods;
+             base.count = min<uint32_t>(base.count + 1, baseline_periods);
+
+             // Smooth the expected count (the first periods set it)
+             base.expected = base.count < warmup_periods ? max<double>(base.expected, piCount) : 0.75 * base.expected + 0.25 * piCount;
+        }
+
+        // Get the median and the robust scale (1.4826 MAD, at least min_scale) of a baseline
+        static void GetBaseline (const int64_t* pValues, uint32_t piCount, int64_t & pMedian, int64_t & pScale)
+        {
+             int64_t values[baseline_periods] = {};
+             copy(pValues, pValues + piCount, values);
+
+             nth_element(values, values + piCount / 2, values + piCount);
+             pMedian = values[piCount / 2];
+
+             for (uint32_t i=0; i<piCount; i++)
+             {
+                  values[i] = llabs(values[i] - pMedian);
+             }
+
+             nth_element(values, values + piCount / 2, values + piCount);
+             pScale = max<int64_t>(static_cast<int64_t>(1.4826 * values[piCount / 2]), min_scale);
+        }
+};
@@ -0,0 +1,829 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include "clock_utils.hpp"
+#include "clock_wire.hpp"
+#include "clock_stats.hpp"
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// clock_bench: Microbenchmarks of the per-message hot path of the clock server and clients.
+//              Results are printed one per line as CSV (benchmark,iterations,ns_per_op,ops_per_sec)
+//              so runs can be compared by scripts; self-checks are printed as CHECK lines, and a
+//              failed one fails the run (exit status).
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+// Declare the sink of benchmark results (keeps the measured work from being optimized away)
+volatile uint64_t bench_sink {0};
+
+// Declare the benchmark selection (prefix of the benchmark names; empty for all)
+string bench_filter;
+
+// Declare the number of failed self-checks (the exit status reports them)
+uint64_t bench_failures {0};
+
+// Check if a benchmark is selected
+bool IsSelected (string const & psName)
+{
+     return bench_filter.empty() || psName.compare(0, bench_filter.size(), bench_filter) == 0;
+}
+
+// Check if any benchmark of a group (names starting with psGroup) may be selected
+bool IsGroupSelected (string const & psGroup)
+{
+     return IsSelected(psGroup) || bench_filter.compare(0, psGroup.size(), psGroup) == 0;
+}
+
+// Print the result of a benchmark
+void PrintBenchmark (string const & psName, uint64_t piIterations, double pElapsed_ns)
+{
+     printf("%s,%llu,%.3f,%.0f\n", psName.c_str(), static_cast<unsigned long long>(piIterations),
+            piIterations > 0 ? pElapsed_ns / piIterations : 0.0, pElapsed_ns > 0 ? piIterations * 1e9 / pElapsed_ns : 0.0);
+     fflush(stdout);
+}
+
+// Get the nanoseconds elapsed since a start time
+double GetElapsed_ns (chrono::steady_clock::time_point pStart)
+{
+     return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - pStart).count();
+}
+
+// Run a benchmark of piIterations calls of func (after a short warm up) and print its result
+template <class Function>
+void RunBenchmark (string const & psName, uint64_t piIterations, Function func)
+{
+     if (!IsSelected(psName))
+     {
+         return;
+     }
+
+     uint64_t sink {0};
+
+     // Warm up caches, tables and branch predictors
+     for (uint64_t i=0; i<piIterations / 10 + 1; i++)
+     {
+          sink += func(i);
+     }
+
+     auto start = chrono::steady_clock::now();
+
+     for (uint64_t i=0; i<piIterations; i++)
+     {
+          sink += func(i);
+     }
+
+     double elapsed_ns = GetElapsed_ns(start);
+     bench_sink = bench_sink + sink;
+
+     PrintBenchmark(psName, piIterations, elapsed_ns);
+}
+
+// Print the result of a self-check (counting failures)
+void PrintCheck (string const & psName, bool pPassed)
+{
+     if (!pPassed)
+     {
+         bench_failures++;
+     }
+
+     printf("CHECK,%s,%s\n", psName.c_str(), pPassed ? "ok" : "FAILED");
+     fflush(stdout);
+}
+
+// Bitwise CRC32C of a run of bytes (reference for the table and instruction versions)
+uint32_t ComputeCRC32CReference (const unsigned char* pBytes, size_t piLength)
+{
+     uint32_t crc {0xffffffff};
+     for (size_t i=0; i<piLength; i++)
+     {
+          crc ^= pBytes[i];
+          for (int bit=0; bit<8; bit++)
+          {
+               crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+          }
+     }
+
+     return ~crc;
+}
+
+// Build a set of random reply messages
+vector<ClockSyncMessage> BuildMessages (size_t piCount)
+{
+     mt19937_64 generator (42);
+     vector<ClockSyncMessage> messages (piCount);
+
+     for (auto & msg : messages)
+     {
+          msg.clock_id     = static_cast<uint32_t>(generator() % 100000);
+          msg.server_id    = static_cast<uint32_t>(generator() % 4);
+          msg.reply_window = static_cast<uint32_t>(generator() % 2) * 50000;
+          msg.sequence     = static_cast<uint32_t>(generator() % 3);
+          msg.server_ts    = GetCurrentTime_ns() + generator() % 1000000000;
+          msg.client_ts    = msg.server_ts + generator() % 1000000;
+          msg.client_tx_ts = msg.client_ts + generator() % 100000;
+     }
+
+     return messages;
+}
+
+// Benchmarks of the integrity functions
+void BenchCheckSum (uint64_t piIterations)
+{
+     if (!IsGroupSelected("checksum") && !IsGroupSelected("validate"))
+     {
+         return;
+     }
+
+     // Declare the messages (a power of two, indexed by mask) and their encoded frames, whose bodies
+     // are checksummed
+     vector<ClockSyncMessage> messages = BuildMessages(1024);
+     const uint64_t mask = messages.size() - 1;
+     const size_t body_length = clock_wire_length - clock_wire_body_offset;
+
+     vector<unsigned char> frames (messages.size() * clock_wire_length);
+     for (size_t i=0; i<messages.size(); i++)
+     {
+          EncodeSyncMessage(messages[i], reinterpret_cast<char*>(&frames[i * clock_wire_length]), clock_wire_length);
+     }
+
+     auto GetBody = [&](uint64_t i) { return &frames[(i & mask) * clock_wire_length + clock_wire_body_offset]; };
+
+     // Check the CRC32C implementations against the bitwise reference (over the frame bodies, and over
+     // runs of every length for the partial words)
+     bool table_ok {true};
+     bool hardware_ok {true};
+     for (size_t i=0; i<messages.size(); i++)
+     {
+          size_t length = i < clock_wire_length ? i : body_length;
+          uint32_t reference = ComputeCRC32CReference(GetBody(i), length);
+
+          clock_crc32c::SetSoftwareOnly(true);
+          table_ok = table_ok && ComputeCRC32C(GetBody(i), length) == reference;
+
+          clock_crc32c::SetSoftwareOnly(false);
+          hardware_ok = hardware_ok && ComputeCRC32C(GetBody(i), length) == reference;
+     }
+
+     PrintCheck("crc32c.table", table_ok);
+     PrintCheck(clock_crc32c::HasHardware() ? "crc32c.sse42" : "crc32c.sse42 (not available; table used)", hardware_ok);
+
+     // Check that the word sum detects swapped fields that the byte sum misses
+     ClockSyncMessage swapped = messages[0];
+     swap(swapped.client_ts, swapped.client_tx_ts);
+     unsigned char swapped_frame[clock_wire_length];
+     EncodeSyncMessage(swapped, reinterpret_cast<char*>(swapped_frame), clock_wire_length);
+     PrintCheck("wordsum.reorder", ComputeWordSum(swapped_frame + clock_wire_body_offset, body_length) != ComputeWordSum(GetBody(0), body_length) &&
+                                   ComputeByteSum(swapped_frame + clock_wire_body_offset, body_length) == ComputeByteSum(GetBody(0), body_length) &&
+                                   swapped.client_ts != swapped.client_tx_ts);
+
+     // Compute each function on its own
+     RunBenchmark("checksum.bytesum", piIterations, [&](uint64_t i) { return ComputeByteSum(GetBody(i), body_length); });
+     RunBenchmark("checksum.wordsum", piIterations, [&](uint64_t i) { return ComputeWordSum(GetBody(i), body_length); });
+
+     clock_crc32c::SetSoftwareOnly(true);
+     RunBenchmark("checksum.crc32c.table", piIterations, [&](uint64_t i) { return ComputeCRC32C(GetBody(i), body_length); });
+     clock_crc32c::SetSoftwareOnly(false);
+
+     if (clock_crc32c::HasHardware())
+     {
+         RunBenchmark("checksum.crc32c.sse42", piIterations, [&](uint64_t i) { return ComputeCRC32C(GetBody(i), body_length); });
+     }
+
+     // Decode and validate frames of each kind (as on every receive; the byte sum of legacy frames)
+     for (ClockCheckSumKind kind : {CHECKSUM_BYTESUM, CHECKSUM_WORDSUM, CHECKSUM_CRC32C})
+     {
+          ClockWireFormat format = kind == CHECKSUM_BYTESUM ? WIRE_LEGACY : WIRE_CURRENT;
+          size_t frame_length = GetWireLength(format);
+          vector<char> signed_frames (messages.size() * frame_length);
+          for (size_t i=0; i<messages.size(); i++)
+          {
+               ClockSyncMessage msg = messages[i];
+               msg.checksum_kind = kind;
+               EncodeSyncMessage(msg, &signed_frames[i * frame_length], frame_length, format);
+          }
+
+          ClockSyncMessage decoded;
+          RunBenchmark(string("validate.") + GetCheckSumName(kind), piIterations, [&](uint64_t i)
+          {
+               return DecodeSyncMessage(&signed_frames[(i & mask) * frame_length], frame_length, decoded) && ValidateCheckSum(decoded);
+          });
+     }
+}
+
+
+// Benchmarks of the per-reply arithmetic and wire coding
+void BenchMessage (uint64_t piIterations)
+{
+     vector<ClockSyncMessage> messages = BuildMessages(1024);
+     const uint64_t mask = messages.size() - 1;
+
+     // Offset and delay of a reply (as computed on every accepted reply)
+     RunBenchmark("offset.compute", piIterations, [&](uint64_t i)
+     {
+          ClockSyncMessage const & msg = messages[i & mask];
+          uint64_t t4 = msg.client_tx_ts + 50;
+          return static_cast<uint64_t>(ComputeOffset(msg, t4) + ComputeDelay(msg, t4));
+     });
+
+     // Encoding and decoding of the wire frames
+     vector<char> frames (messages.size() * clock_wire_length);
+     for (size_t i=0; i<messages.size(); i++)
+     {
+          EncodeSyncMessage(messages[i], &frames[i * clock_wire_length], clock_wire_length);
+     }
+
+     char frame[clock_wire_length];
+     RunBenchmark("wire.encode", piIterations, [&](uint64_t i) { return EncodeSyncMessage(messages[i & mask], frame, sizeof(frame)) + static_cast<unsigned char>(frame[i % sizeof(frame)]); });
+
+     ClockSyncMessage decoded;
+     RunBenchmark("wire.decode", piIterations, [&](uint64_t i) { return DecodeSyncMessage(&frames[(i & mask) * clock_wire_length], clock_wire_length, decoded) + decoded.server_ts; });
+
+     // Check that current frames keep every field (nanoseconds included) and legacy frames still validate
+     if (IsGroupSelected("wire"))
+     {
+         ClockSyncMessage msg = messages[0];
+         msg.server_id     = 7;
+         msg.reply_window  = 250000;
+         msg.sequence      = 12345;
+         msg.checksum_kind = CHECKSUM_CRC32C;
+
+         for (ClockWireFormat format : {WIRE_LEGACY, WIRE_CURRENT})
+         {
+              ClockWireFormat decoded_format;
+              size_t length = EncodeSyncMessage(msg, frame, sizeof(frame), format);
+              bool ok = DecodeSyncMessage(frame, length, decoded, decoded_format) && decoded_format == format && ValidateCheckSum(decoded);
+
+              if (format == WIRE_CURRENT)
+              {
+                  ok = ok && decoded.server_ts == msg.server_ts && decoded.client_ts == msg.client_ts && decoded.client_tx_ts == msg.client_tx_ts &&
+                       decoded.server_id == msg.server_id && decoded.reply_window == msg.reply_window && decoded.sequence == msg.sequence;
+              }
+
+              PrintCheck(string("wire.") + GetWireFormatName(format), ok);
+         }
+     }
+}
+
+// Benchmarks of the time stamp sources (raw reads and the time of the selected source)
+void BenchTimeSource (uint64_t piIterations)
+{
+     if (!IsGroupSelected("time"))
+     {
+         return;
+     }
+
+     RunBenchmark("time.read.realtime", piIterations, [](uint64_t) { return clock_time_source::ReadRealtime(); });
+     RunBenchmark("time.read.monotonic-raw", piIterations, [](uint64_t) { return clock_time_source::ReadMonotonicRaw(); });
+
+     if (clock_time_source::HasInvariantTSC())
+     {
+         RunBenchmark("time.read.tsc", piIterations, [](uint64_t) { return clock_time_source::ReadTSC(); });
+     }
+
+     // Time of every available source (checked against the realtime clock after a pause)
+     for (ClockTimeSource source : {TIME_REALTIME, TIME_MONOTONIC_RAW, TIME_TSC})
+     {
+          if (source == TIME_TSC && !clock_time_source::HasInvariantTSC())
+          {
+              continue;
+          }
+
+          clock_time_source & time_source = clock_time_source::GetTimeSource();
+          time_source.Select(source);
+
+          string name = string("time.now.") + GetTimeSourceName(source);
+          RunBenchmark(name, piIterations, [](uint64_t) { return GetCurrentTime_ns(); });
+
+          this_thread::sleep_for(chrono::milliseconds(100));
+          int64_t difference = time_source.GetRealtimeDifference();
+          PrintCheck(name + " realtime difference ns " + to_string(difference), llabs(difference) < 100000);
+     }
+
+     clock_time_source::GetTimeSource().Select(TIME_REALTIME);
+}
+
+// Benchmarks of clock_stats::AddPoint from 1 up to piThreads threads adding into one collection
+void BenchAddPoint (uint64_t piIterations, uint32_t piThreads, string const & psOutput)
+{
+     const uint32_t clients {10000};
+
+     for (bool streaming : {false, true})
+     {
+          for (bool filtered : {false, true})
+          {
+               for (uint32_t threads=1; threads<=piThreads; threads*=2)
+               {
+                    string name = string("addpoint.") + (streaming ? "sketch" : "samples") + (filtered ? ".filter" : "") + ".threads" + to_string(threads);
+                    if (!IsSelected(name))
+                    {
+                        continue;
+                    }
+
+                    clock_stats stats (streaming, -1, psOutput);
+                    stats.SetDelayFilter(filtered ? 8 : 0, 200);
+
+                    // Each thread adds its share of the points for all clients (in a different order)
+                    uint64_t per_thread = piIterations / threads;
+                    vector<thread> workers;
+                    auto start = chrono::steady_clock::now();
+
+                    for (uint32_t t=0; t<threads; t++)
+                    {
+                         workers.push_back(thread([&stats, t, per_thread]()
+                         {
+                              for (uint64_t i=0; i<per_thread; i++)
+                              {
+                                   uint32_t id = static_cast<uint32_t>((i * 7919 + t * 104729) % clients) + 1;
+                                   stats.AddPoint(id, static_cast<int64_t>(i & 1023) - 512, 100 + static_cast<int64_t>(i & 63));
+                              }
+                         }));
+                    }
+
+                    for (auto & worker : workers)
+                    {
+                         worker.join();
+                    }
+
+                    PrintBenchmark(name, per_thread * threads, GetElapsed_ns(start));
+               }
+          }
+     }
+}
+
+// Benchmark of the per-sample update of the drift estimator (checked against a known drift)
+void BenchDrift (uint64_t piIterations)
+{
+     if (!IsGroupSelected("drift"))
+     {
+         return;
+     }
+
+     // A client drifting 12.5 ppm from a 300 us offset, sampled every second with 20 us of noise
+     clock_drift drift;
+     mt19937_64 generator (11);
+     normal_distribution<double> noise (0.0, 20.0);
+     const uint64_t start_ns {1500000000ull * 1000000000};
+
+     for (uint64_t k=0; k<600; k++)
+     {
+          drift.Add(start_ns + k * 1000000000, llround(300.0 + 12.5 * k + noise(generator)), 120);
+     }
+
+     ClockDriftEstimate estimate = drift.GetEstimate();
+     PrintCheck("drift.fit ppm " + to_string(estimate.ppm) + " jitter " + to_string(estimate.jitter),
+                estimate.valid && fabs(estimate.ppm - 12.5) < 0.5 && llabs(estimate.offset - 7787) < 20 && estimate.jitter > 10 && estimate.jitter < 30);
+
+     vector<int64_t> offsets (1024);
+     for (auto & offset : offsets)
+     {
+          offset = llround(noise(generator));
+     }
+
+     RunBenchmark("drift.add", piIterations, [&](uint64_t i)
+     {
+          drift.Add(start_ns + i * 1000000, offsets[i & 1023], 120);
+          return static_cast<uint64_t>(i);
+     });
+}
+
+// Benchmark of the round tracker per reply (checked against a client missing, delaying and repeating replies)
+void BenchRounds (uint64_t piIterations)
+{
+     if (!IsGroupSelected("rounds"))
+     {
+         return;
+     }
+
+     // Rounds 1-2 in time, round 3 repeated, round 4 late, rounds 5-6 missed, round 7 in time, then
+     // silent past the window
+     clock_rounds rounds;
+     uint64_t missed {0};
+     bool ok = rounds.Check(1, 1, missed) == ROUND_ON_TIME && rounds.Check(2, 2, missed) == ROUND_ON_TIME &&
+               rounds.Check(3, 3, missed) == ROUND_ON_TIME && rounds.Check(3, 3, missed) == ROUND_DUPLICATE &&
+               rounds.Check(4, 5, missed) == ROUND_LATE && rounds.Check(7, 7, missed) == ROUND_ON_TIME && missed == 3;
+     ok = ok && rounds.Close(9, missed) && missed == 4 && !rounds.Close(7 + clock_rounds::window + 10, missed) && missed == 3 + clock_rounds::window;
+     PrintCheck("rounds.track", ok);
+
+     // Ten clients answering rounds 1-3, then rounds 4-6 broadcast with no reply at all: the rounds over
+     // are missed all the same (round 6 is not over yet)
+     clock_stats stats (false, -1, "/dev/null");
+     stats.SetBroadcastClocks(1);
+     for (uint32_t round=1; round<=6; round++)
+     {
+          stats.SetRound(0, round, round * 1000);
+          for (uint32_t id=1; id<=10 && round<=3; id++)
+          {
+               stats.AddPoint(0, id, 0, 100, round * 1000 + id, round, 0);
+          }
+
+          if (round == 3)
+          {
+              stats.RecordStatistics();
+              ok = stats.GetRoundCounts().on_time == 30 && stats.GetRoundCounts().missed == 0;
+          }
+     }
+     stats.RecordStatistics();
+     PrintCheck("rounds.silent", ok && stats.GetRoundCounts().on_time == 0 && stats.GetRoundCounts().missed == 20);
+
+     // Replies to round 6 processed once round 7 went out: in time if received before it, else late
+     stats.SetRound(0, 7, 7000);
+     stats.AddPoint(0, 1, 0, 100, 6999, 6, 0);
+     stats.AddPoint(0, 2, 0, 100, 7001, 6, 0);
+     stats.RecordStatistics();
+     ClockRoundCounts counts = stats.GetRoundCounts();
+     PrintCheck("rounds.arrival", counts.on_time == 1 && counts.late == 1 && counts.missed == 9);
+
+     // Clients answering every round in time, one reply per iteration
+     const uint32_t clients {1024};
+     vector<clock_rounds> trackers (clients);
+     RunBenchmark("rounds.check", piIterations, [&](uint64_t i)
+     {
+          uint32_t round = static_cast<uint32_t>(i / clients) + 1;
+          return static_cast<uint64_t>(trackers[i % clients].Check(round, round, missed));
+     });
+}
+
+// Benchmark of the client registry lookup per reply (checked against expiry and the move of the clients left)
+void BenchRegistry (uint64_t piIterations)
+{
+     if (!IsGroupSelected("registry"))
+     {
+         return;
+     }
+
+     // 1000 clients registered, the even ones replying later: the odd ones expire (but client 1, kept)
+     // and their slots are reused; once under a quarter of the slots stay in use the clients move down
+     clock_registry registry;
+     vector<uint32_t> moved;
+     bool added {false}, ok {true};
+
+     for (uint32_t id=1; id<=1000; id++)
+     {
+          uint32_t slot = registry.Register(7, id, added);
+          registry.GetClient(slot).last_seen_ns = id % 2 == 0 ? 2000 : 1000;
+          ok = ok && added && slot == id - 1;
+     }
+
+     ok = ok && registry.Expire(1500, [](uint32_t pSlot) { return pSlot == 0; }, moved) == 499 && moved.empty() && registry.GetActive() == 501;
+     ok = ok && registry.Register(7, 3, added) < 1000 && added && registry.Register(7, 4, added) == 3 && !added;
+
+     // Expire all but clients 1, 2 and 4: the clients move down in slot order
+     ok = ok && registry.Expire(3000, [](uint32_t pSlot) { return pSlot <= 1 || pSlot == 3; }, moved) == 499 && registry.GetActive() == 3;
+     ok = ok && moved.size() == 1000 && moved[0] == 0 && moved[1] == 1 && moved[3] == 2 && moved[5] == clock_registry::no_slot;
+     ok = ok && registry.GetCapacity() == 3 && registry.Register(7, 4, added) == 2 && !added && registry.Register(7, 1001, added) == 3 && added;
+     PrintCheck("registry.expire", ok);
+
+     // Lookups of 100000 registered clients, one per iteration
+     const uint32_t clients {100000};
+     for (uint32_t id=0; id<clients; id++)
+     {
+          registry.Register(1, id, added);
+     }
+
+     RunBenchmark("registry.lookup", piIterations, [&](uint64_t i)
+     {
+          return static_cast<uint64_t>(registry.Register(1, static_cast<uint32_t>((i * 7919) % clients), added));
+     });
+}
+
+// Benchmark of the anomaly detector per client and period (checked against injected anomalies)
+void BenchAnomaly (uint64_t piIterations)
+{
+     if (!IsGroupSelected("anomaly"))
+     {
+         return;
+     }
+
+     // Clients 1-4 replying 60 times a period around -50 us: client 1 spikes in period 10, client 2
+     // steps by 2 ms from period 10, client 3 halves its replies from period 10, client 4 goes silent
+     clock_anomaly anomaly (6.0);
+     vector<clock_anomaly::clock_baseline> baselines (5);
+     vector<ClockAlert> alerts;
+     uint32_t kinds[4] = {};
+     bool quiet {true};
+
+     for (uint32_t p=0; p<14; p++)
+     {
+          for (uint32_t id=1; id<=4; id++)
+          {
+               int64_t noise   = static_cast<int64_t>((p * 37 + id * 11) % 9) - 4;
+               int64_t median  = -50 + noise + (id == 2 && p >= 10 ? 2000 : 0);
+               int64_t spread  = 150 + noise * 3 + (id == 1 && p == 10 ? 19000 : 0);
+               uint64_t count  = id == 3 && p >= 10 ? 25 : 60;
+
+               if (id != 4 || p < 10)
+               {
+                   anomaly.Check(baselines[id], 0, id, count, median - spread, median, median + spread / 2, alerts);
+               }
+          }
+
+          for (uint32_t id=1; id<=4; id++)
+          {
+               anomaly.CheckSilent(baselines[id], alerts);
+          }
+          anomaly.EndPeriod();
+
+          for (auto const & alert : alerts)
+          {
+               quiet = quiet && p >= 10;
+               kinds[alert.clock_id - 1] |= 1u << alert.kind;
+          }
+          alerts.clear();
+     }
+
+     PrintCheck("anomaly.detect", quiet && kinds[0] == (1u << ALERT_OUTLIER) && kinds[1] == (1u << ALERT_STEP) &&
+                                  kinds[2] == (1u << ALERT_COUNT_DROP) && kinds[3] == (1u << ALERT_SILENT));
+
+     // Steady clients (warmed up) checked once per iteration
+     const uint32_t clients {1024};
+     baselines.resize(clients + 1);
+     RunBenchmark("anomaly.check", piIterations, [&](uint64_t i)
+     {
+          uint32_t id = static_cast<uint32_t>(i % clients) + 1;
+          int64_t noise = static_cast<int64_t>(i % 7) - 3;
+          anomaly.Check(baselines[id], 1, id, 60, -200 + noise, -50 + noise, 100 + noise, alerts);
+          if (id == clients)
+          {
+              anomaly.EndPeriod();
+              alerts.clear();
+          }
+          return static_cast<uint64_t>(alerts.size());
+     });
+}
+
+// Benchmarks of clock_stats::ComputeStatistics for periods of piSamples samples
+void BenchComputeStatistics (uint64_t piIterations)
+{
+     clock_stats stats (false, -1, "/dev/null");
+     mt19937_64 generator (7);
+
+     for (uint64_t samples : {10, 100, 1000, 10000, 100000})
+     {
+          string name = "computestats.samples" + to_string(samples);
+          if (!IsSelected(name))
+          {
+              continue;
+          }
+
+          // Declare the period samples (copied before every call, as they are reordered in place)
+          vector<int64_t> period (samples);
+          for (auto & sample : period)
+          {
+               sample = static_cast<int64_t>(generator() % 20000) - 10000;
+          }
+
+          vector<int64_t> work;
+          uint64_t iterations = max<uint64_t>(piIterations / samples, 10);
+
+          RunBenchmark(name, iterations, [&](uint64_t)
+          {
+               work = period;
+               return stats.ComputeStatistics(work).size();
+          });
+     }
+}
+
+// Benchmarks of clock_stats::RecordStatistics for periods of 10, 500 and 10000 clients
+void BenchRecordStatistics (uint64_t piIterations, string const & psOutput)
+{
+     // Declare the samples of every client in a period (one reply per second over a minute)
+     const uint32_t samples {60};
+
+     for (bool streaming : {false, true})
+     {
+          for (uint32_t clients : {10, 500, 10000})
+          {
+               string name = string("recordstats.") + (streaming ? "sketch" : "samples") + ".clients" + to_string(clients);
+               if (!IsSelected(name))
+               {
+                   continue;
+               }
+
+               clock_stats stats (streaming, -1, psOutput);
+               uint64_t periods = max<uint64_t>(piIterations / (clients * samples * 10), 5);
+               double elapsed_ns {0};
+
+               for (uint64_t p=0; p<periods; p++)
+               {
+                    // Fill the period (not timed)
+                    for (uint32_t id=1; id<=clients; id++)
+                    {
+                         for (uint32_t k=0; k<samples; k++)
+                         {
+                              stats.AddPoint(id, static_cast<int64_t>((id * 31 + k * 17) % 2000) - 1000);
+                         }
+                    }
+
+                    // Time the snapshot, summaries and hand-off to the writer
+                    auto start = chrono::steady_clock::now();
+                    stats.RecordStatistics();
+                    elapsed_ns += GetElapsed_ns(start);
+               }
+
+               PrintBenchmark(name, periods, elapsed_ns);
+          }
+     }
+}
+
+// Benchmark of the reply path end to end over loopback: encode and send in batches, then receive,
+// decode, validate, compute the offset and delay and add the point (per reply)
+void BenchLoopback (uint64_t piIterations, string const & psOutput)
+{
+     string name = "loopback.reply";
+     if (!IsSelected(name))
+     {
+         return;
+     }
+
+     // Open the receiving socket on an ephemeral loopback port and the sending socket
+     int rx = socket(AF_INET, SOCK_DGRAM, 0);
+     int tx = socket(AF_INET, SOCK_DGRAM, 0);
+     if (rx < 0 || tx < 0)
+     {
+         cerr << "Error Opening loopback sockets" << endl;
+         return;
+     }
+
+     struct sockaddr_in addr;
+     memset(&addr, 0, sizeof(addr));
+     addr.sin_family      = AF_INET;
+     addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+     addr.sin_port        = 0;
+     socklen_t addr_len   = sizeof(addr);
+
+     struct timeval timeout {0, 100000};
+     if (bind(rx, (struct sockaddr*)&addr, sizeof(addr)) < 0 || getsockname(rx, (struct sockaddr*)&addr, &addr_len) < 0 ||
+         setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+     {
+         cerr << "Error Binding loopback socket" << endl;
+         close(rx);
+         close(tx);
+         return;
+     }
+
+     // Declare the batches on both ends
+     enum { batch = 64, max_length_recv = 256 };
+     vector<ClockSyncMessage> messages = BuildMessages(1024);
+     vector<char> send_frames (batch * clock_wire_length);
+     vector<char> recv_frames (batch * max_length_recv);
+     vector<struct mmsghdr> send_msgs (batch), recv_msgs (batch);
+     vector<struct iovec> send_iovecs (batch), recv_iovecs (batch);
+
+     for (int i=0; i<batch; i++)
+     {
+          memset(&send_msgs[i], 0, sizeof(struct mmsghdr));
+          send_iovecs[i].iov_base = &send_frames[i * clock_wire_length];
+          send_msgs[i].msg_hdr.msg_iov     = &send_iovecs[i];
+          send_msgs[i].msg_hdr.msg_iovlen  = 1;
+          send_msgs[i].msg_hdr.msg_name    = &addr;
+          send_msgs[i].msg_hdr.msg_namelen = sizeof(addr);
+
+          memset(&recv_msgs[i], 0, sizeof(struct mmsghdr));
+          recv_iovecs[i].iov_base = &recv_frames[i * max_length_recv];
+          recv_iovecs[i].iov_len  = max_length_recv;
+          recv_msgs[i].msg_hdr.msg_iov    = &recv_iovecs[i];
+          recv_msgs[i].msg_hdr.msg_iovlen = 1;
+     }
+
+     clock_stats stats (false, -1, psOutput);
+     stats.SetDelayFilter(8, 200);
+
+     uint64_t rounds = max<uint64_t>(piIterations / 10 / batch, 10);
+     uint64_t received {0};
+     auto start = chrono::steady_clock::now();
+
+     for (uint64_t r=0; r<rounds; r++)
+     {
+          // Client side: sign, encode and send a batch of replies
+          for (int i=0; i<batch; i++)
+          {
+               ClockSyncMessage msg = messages[(r * batch + i) & 1023];
+               msg.checksum_kind = CHECKSUM_CRC32C;
+               send_iovecs[i].iov_len = EncodeSyncMessage(msg, &send_frames[i * clock_wire_length], clock_wire_length);
+          }
+
+          if (sendmmsg(tx, send_msgs.data(), batch, 0) < 0)
+          {
+              cerr << "Error in loopback sendmmsg" << endl;
+              break;
+          }
+
+          // Server side: receive the batch and process every reply
+          int pending = batch;
+          while (pending > 0)
+          {
+               int n = recvmmsg(rx, recv_msgs.data(), pending, MSG_WAITFORONE, NULL);
+               if (n <= 0)
+               {
+                   break;
+               }
+
+               uint64_t t4 = GetCurrentTime_ns();
+               for (int i=0; i<n; i++)
+               {
+                    ClockSyncMessage msg;
+                    if (DecodeSyncMessage(&recv_frames[i * max_length_recv], recv_msgs[i].msg_len, msg) && ValidateCheckSum(msg))
+                    {
+                        stats.AddPoint(msg.clock_id, RoundToMicroseconds(ComputeOffset(msg, t4)), RoundToMicroseconds(ComputeDelay(msg, t4)));
+                        received++;
+                    }
+               }
+
+               pending -= n;
+          }
+     }
+
+     PrintBenchmark(name, received, GetElapsed_ns(start));
+
+     // Report replies lost on the loopback (socket buffer overruns)
+     if (received < rounds * batch)
+     {
+         PrintCheck("loopback.lost " + to_string(rounds * batch - received), false);
+     }
+
+     close(rx);
+     close(tx);
+}
+
+// ****************************
+// Main entry point
+// ****************************
+int main(int argc, char* argv[])
+{
+  try
+  {
+      // Check for help
+      if (HasCommandOption(argc, argv, "--help"))
+      {
+          cerr << "\nUsage: clock_bench [--iterations <n>] [--filter <benchmark name prefix>] [--threads <max AddPoint threads>] [--output <statistics file>]\n";
+          return -1;
+      }
+
+      // Declare the number of iterations of each benchmark (default 10 million)
+      uint64_t iterations = strtoull(GetCommandOption(argc, argv, "--iterations", "10000000").c_str(), NULL, 10);
+      bench_filter = GetCommandOption(argc, argv, "--filter");
+
+      // Declare the maximum number of threads adding points (default the hardware threads)
+      uint32_t threads = atoi(GetCommandOption(argc, argv, "--threads", to_string(max(thread::hardware_concurrency(), 1u))).c_str());
+
+      // Declare the file receiving the recorded statistics (default discarded)
+      string output = GetCommandOption(argc, argv, "--output", "/dev/null");
+
+      // Print the header of the results
+      printf("benchmark,iterations,ns_per_op,ops_per_sec\n");
+
+      // Integrity functions
+      iterations = max<uint64_t>(iterations, 1);
+      BenchCheckSum(iterations);
+
+      // Per-reply arithmetic and wire coding
+      BenchMessage(iterations);
+
+      // Time stamp sources
+      BenchTimeSource(iterations);
+
+      // Statistics collection, summaries and periods
+      BenchAddPoint(iterations, max(threads, 1u), output);
+      BenchDrift(iterations);
+      BenchAnomaly(iterations);
+      BenchRounds(iterations);
+      BenchRegistry(iterations);
+      BenchComputeStatistics(iterations);
+      BenchRecordStatistics(iterations, output);
+
+      // Reply path end to end over loopback
+      BenchLoopback(iterations, output);
+  }
+  catch (exception& e)
+  {
+      cerr << e.what() << endl;
+      return EXIT_FAILURE;
+  }
+
+  // Fail the run (and make bench) if any self-check failed
+  if (bench_failures > 0)
+  {
+      cerr << "\nSelf-checks FAILED [" << bench_failures << "]\n";
+      return EXIT_FAILURE;
+  }
+
+  return 0;
+}
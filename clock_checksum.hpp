@@ -0,0 +1,360 @@
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <string>
+
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#include <nmmintrin.h>
+#define CLOCK_CRC32C_SSE42
+#endif
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// Integrity functions of the sync messages, computed over the encoded frame: the original 16-bit
+// byte sum (legacy frames only), a word-at-a-time Fletcher-style sum (position sensitive, so
+// reordered words are detected) and CRC32C (Castagnoli; SSE4.2 crc32 instruction when the cpu
+// has it, slicing table otherwise). Multi-byte values are always taken in little-endian byte
+// order, as on the wire.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+// Checksum kinds (carried in the flags of the wire frame)
+enum ClockCheckSumKind : uint8_t
+{
+     CHECKSUM_BYTESUM = 0,  // 16-bit sum of the field bytes of legacy frames (original release)
+     CHECKSUM_WORDSUM = 1,  // 32-bit Fletcher-style sum of the 32-bit words of the frame body
+     CHECKSUM_CRC32C  = 2   // CRC32C of the frame body
+};
+
+// Little-endian loads and stores (byte order independent of the host)
+inline uint16_t LoadLE16 (const unsigned char* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+inline uint32_t LoadLE32 (const unsigned char* p) { return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24); }
+inline uint64_t LoadLE64 (const unsigned char* p) { return static_cast<uint64_t>(LoadLE32(p)) | (static_cast<uint64_t>(LoadLE32(p + 4)) << 32); }
+
+inline void StoreLE16 (unsigned char* p, uint16_t v) { p[0] = v & 0xff; p[1] = (v >> 8) & 0xff; }
+inline void StoreLE32 (unsigned char* p, uint32_t v) { for (int i=0; i<4; i++) p[i] = (v >> (i * 8)) & 0xff; }
+inline void StoreLE64 (unsigned char* p, uint64_t v) { StoreLE32(p, static_cast<uint32_t>(v)); StoreLE32(p + 4, static_cast<uint32_t>(v >> 32)); }
+
+// Get the name of a checksum kind
+const char* GetCheckSumName (ClockCheckSumKind pKind)
+{
+     switch (pKind)
+     {
+          case CHECKSUM_BYTESUM: return "bytesum";
+          case CHECKSUM_WORDSUM: return "wordsum";
+          case CHECKSUM_CRC32C:  return "crc32c";
+     }
+
+     return "unknown";
+}
+
+// Parse the name of a checksum kind of the current frames (false if unknown; the byte sum is only
+// used by legacy frames)
+bool ParseCheckSumName (string const & psName, ClockCheckSumKind & pKind)
+{
+     for (ClockCheckSumKind kind : {CHECKSUM_WORDSUM, CHECKSUM_CRC32C})
+     {
+          if (psName == GetCheckSumName(kind))
+          {
+              pKind = kind;
+              return true;
+          }
+     }
+
+     return false;
+}
+
+//
+//***********************************************************************************************
+//
+// Class clock_wordsum: Fletcher-style running sum over 32-bit words. The second sum weighs every
+//                      word by its position, so swapped or reordered words change the result.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_wordsum
+{
+        // Declare the running sums (wide enough not to overflow on a message)
+        uint64_t sum1 {0};
+        uint64_t sum2 {0};
+
+public:
+
+        // Add a 32-bit word
+        void Add32 (uint32_t pWord)
+        {
+             sum1 += pWord;
+             sum2 += sum1;
+        }
+
+        // Add a 64-bit value as two words (low word first)
+        void Add64 (uint64_t pValue)
+        {
+             Add32(static_cast<uint32_t>(pValue));
+             Add32(static_cast<uint32_t>(pValue >> 32));
+        }
+
+        // Add a run of bytes as little-endian words (a last partial word is padded with zeros)
+        void Add (const unsigned char* pBytes, size_t piLength)
+        {
+             size_t i {0};
+             for (; i + 4 <= piLength; i += 4)
+             {
+                  Add32(LoadLE32(pBytes + i));
+             }
+
+             if (i < piLength)
+             {
+                 unsigned char tail[4] = {};
+                 copy(pBytes + i, pBytes + piLength, tail);
+                 Add32(LoadLE32(tail));
+             }
+        }
+
+        // Get the checksum (each sum folded to 16 bits with end-around carry)
+        uint32_t Get () const
+        {
+             return (static_cast<uint32_t>(Fold(sum2)) << 16) | Fold(sum1);
+        }
+
+private:
+
+        // Fold a sum to 16 bits (ones' complement addition)
+        static uint16_t Fold (uint64_t pSum)
+        {
+             while (pSum >> 16)
+             {
+                  pSum = (pSum & 0xffff) + (pSum >> 16);
+             }
+
+             return static_cast<uint16_t>(pSum);
+        }
+};
+
+//
+//***********************************************************************************************
+//
+// Class clock_crc32c: Running CRC32C (reflected polynomial 0x82f63b78). Uses the SSE4.2 crc32
+//                     instruction when available at run time, otherwise slicing-by-8 tables.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_crc32c
+{
+        // Declare the running crc (pre-inverted)
+        uint32_t crc {0xffffffff};
+
+        // Declare the implementation (selected once per crc)
+        bool hardware {HasHardware()};
+
+public:
+
+        // Add a 32-bit value
+        void Add32 (uint32_t pValue)
+        {
+#if defined CLOCK_CRC32C_SSE42
+             if (hardware)
+             {
+                 crc = Hardware32(crc, pValue);
+                 return;
+             }
+#endif
+             crc = Software(crc, pValue, 4);
+        }
+
+        // Add a 64-bit value
+        void Add64 (uint64_t pValue)
+        {
+#if defined CLOCK_CRC32C_SSE42 && defined __x86_64__
+             if (hardware)
+             {
+                 crc = Hardware64(crc, pValue);
+                 return;
+             }
+#endif
+             crc = Software(crc, pValue, 8);
+        }
+
+        // Add a byte
+        void Add8 (uint8_t pValue)
+        {
+#if defined CLOCK_CRC32C_SSE42
+             if (hardware)
+             {
+                 crc = Hardware8(crc, pValue);
+                 return;
+             }
+#endif
+             crc = (crc >> 8) ^ GetTables()[0][(crc ^ pValue) & 0xff];
+        }
+
+        // Add a run of bytes (eight at a time, then four, then one)
+        void Add (const unsigned char* pBytes, size_t piLength)
+        {
+             size_t i {0};
+             for (; i + 8 <= piLength; i += 8)
+             {
+                  Add64(LoadLE64(pBytes + i));
+             }
+
+             if (i + 4 <= piLength)
+             {
+                 Add32(LoadLE32(pBytes + i));
+                 i += 4;
+             }
+
+             for (; i < piLength; i++)
+             {
+                  Add8(pBytes[i]);
+             }
+        }
+
+        // Get the crc
+        uint32_t Get () const
+        {
+             return ~crc;
+        }
+
+        // Check if the crc32 instruction is used
+        static bool HasHardware ()
+        {
+#if defined CLOCK_CRC32C_SSE42
+             static const bool hardware = __builtin_cpu_supports("sse4.2");
+             return hardware && !software_only;
+#else
+             return false;
+#endif
+        }
+
+        // Force the table implementation (for comparison)
+        static void SetSoftwareOnly (bool pSoftwareOnly)
+        {
+             software_only = pSoftwareOnly;
+        }
+
+private:
+
+        // Declare the table implementation override
+        static bool software_only;
+
+        // Get the slicing-by-8 tables
+        static const uint32_t (&GetTables ())[8][256]
+        {
+             static uint32_t tables[8][256];
+             static bool built = BuildTables(tables);
+             (void) built;
+             return tables;
+        }
+
+        // Build the slicing-by-8 tables
+        static bool BuildTables (uint32_t (&tables)[8][256])
+        {
+             for (uint32_t i=0; i<256; i++)
+             {
+                  uint32_t value = i;
+                  for (int bit=0; bit<8; bit++)
+                  {
+                       value = (value >> 1) ^ (0x82f63b78 & (0 - (value & 1)));
+                  }
+                  tables[0][i] = value;
+             }
+
+             for (uint32_t i=0; i<256; i++)
+             {
+                  for (int t=1; t<8; t++)
+                  {
+                       tables[t][i] = (tables[t-1][i] >> 8) ^ tables[0][tables[t-1][i] & 0xff];
+                  }
+             }
+
+             return true;
+        }
+
+        // Table implementation over the pBytes low-order bytes of a value (little-endian order)
+        static uint32_t Software (uint32_t pCrc, uint64_t pValue, int pBytes)
+        {
+             const uint32_t (&tables)[8][256] = GetTables();
+
+             if (pBytes == 8)
+             {
+                 uint64_t value = pValue ^ pCrc;
+                 return tables[7][value & 0xff]         ^ tables[6][(value >> 8) & 0xff]  ^
+                        tables[5][(value >> 16) & 0xff] ^ tables[4][(value >> 24) & 0xff] ^
+                        tables[3][(value >> 32) & 0xff] ^ tables[2][(value >> 40) & 0xff] ^
+                        tables[1][(value >> 48) & 0xff] ^ tables[0][value >> 56];
+             }
+
+             uint32_t value = static_cast<uint32_t>(pValue) ^ pCrc;
+             return tables[3][value & 0xff]         ^ tables[2][(value >> 8) & 0xff] ^
+                    tables[1][(value >> 16) & 0xff] ^ tables[0][value >> 24];
+        }
+
+#if defined CLOCK_CRC32C_SSE42
+        // Instruction implementation (compiled for SSE4.2 regardless of the build flags)
+        __attribute__((target("sse4.2"))) static uint32_t Hardware8 (uint32_t pCrc, uint8_t pValue)
+        {
+             return _mm_crc32_u8(pCrc, pValue);
+        }
+
+        __attribute__((target("sse4.2"))) static uint32_t Hardware32 (uint32_t pCrc, uint32_t pValue)
+        {
+             return _mm_crc32_u32(pCrc, pValue);
+        }
+
+#if defined __x86_64__
+        __attribute__((target("sse4.2"))) static uint32_t Hardware64 (uint32_t pCrc, uint64_t pValue)
+        {
+             return static_cast<uint32_t>(_mm_crc32_u64(pCrc, pValue));
+        }
+#endif
+#endif
+};
+
+bool clock_crc32c::software_only {false};
+
+// Computation of the original byte sum of a run of bytes (folded to 16 bits by wrapping)
+uint16_t ComputeByteSum (const unsigned char* pBytes, size_t piLength)
+{
+     uint16_t checksum {0};
+     for (size_t i=0; i<piLength; i++)
+     {
+          checksum += pBytes[i];
+     }
+
+     return checksum;
+}
+
+// Computation of the word sum of a run of bytes
+uint32_t ComputeWordSum (const unsigned char* pBytes, size_t piLength)
+{
+     clock_wordsum sum;
+     sum.Add(pBytes, piLength);
+     return sum.Get();
+}
+
+// Computation of the CRC32C of a run of bytes
+uint32_t ComputeCRC32C (const unsigned char* pBytes, size_t piLength)
+{
+     clock_crc32c crc;
+     crc.Add(pBytes, piLength);
+     return crc.Get();
+}
+
+// Computation of the checksum of the given kind over a run of bytes (the body of an encoded frame)
+uint32_t ComputeCheckSum (ClockCheckSumKind pKind, const unsigned char* pBytes, size_t piLength)
+{
+     switch (pKind)
+     {
+          case CHECKSUM_WORDSUM: return ComputeWordSum(pBytes, piLength);
+          case CHECKSUM_CRC32C:  return ComputeCRC32C(pBytes, piLength);
+          default:               return ComputeByteSum(pBytes, piLength);
+     }
+}
@@ -4,12 +4,17 @@
 #include <vector>
 #include <string>
 #include <chrono>
+#include <thread>
+#include <memory>
+#include <algorithm>
 
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/bind.hpp>
 
 #include "clock_utils.hpp"
+#include "clock_wire.hpp"
 
 using boost::asio::ip::udp;
 using boost::asio::ip::address;
@@ -35,8 +40,8 @@ class clock_client {
         // Declare client id 
         uint32_t client_id;
 
-        // Declare clock id 
-        uint32_t clock_id {0};
+        // Declare the clock ids answered (any clock if empty)
+        vector<uint32_t> clock_ids;
 
         // Declare error code
         boost::system::error_code err;
@@ -52,10 +57,13 @@ class clock_client {
         enum { max_length = 256 };
         char data_[max_length];
 
+        // Declare the wire format of the last broadcast (replies are sent in the same format)
+        ClockWireFormat wire_format {WIRE_CURRENT};
+
 public:
 
         // Constructor
-        clock_client (uint32_t pClientid, uint32_t pClockid) : client_id(pClientid), clock_id(pClockid) 
+        clock_client (uint32_t pClientid, vector<uint32_t> const & pClockIDs) : client_id(pClientid), clock_ids(pClockIDs) 
         {
         }
 
@@ -100,29 +108,28 @@ private:
             if (!error)
             {
                 // Get the immediate (client) time stamp when server message is received 
-                uint64_t TimeStamp = GetCurrentTimeSinceEpoch();
+                uint64_t TimeStamp = GetCurrentTime_ns();
                   
-                // Check if message is fully received
-                if (bytes_recvd == sizeof(ClockSyncMessage)) 
+                // Check if message is fully received and decode it
+                ClockSyncMessage oReceivedMessage;
+                if (DecodeSyncMessage(data_, bytes_recvd, oReceivedMessage, wire_format)) 
                 {
-                    // Get a pointer to the received sync message
-                    ClockSyncMessage* oReceivedMessage = reinterpret_cast<ClockSyncMessage*>(data_);
 #if !defined NO_PRINT
 		    // Indicate Message
-		    PrintSyncMessage("recvd", *oReceivedMessage);
+		    PrintSyncMessage("recvd", oReceivedMessage);
 #endif
                     // Validate the message's checksum before processing 
-                    // The previous message size check and current checksum validation ensures message integrity
-                    if (ValidateCheckSum (*oReceivedMessage)) 
+                    // The frame checks of the decoder and current checksum validation ensures message integrity
+                    if (ValidateCheckSum (oReceivedMessage)) 
                     {
-                        // Check if a specific server is only to be processed
-                        if (clock_id == 0 || clock_id == oReceivedMessage->clock_id) 
+                        // Check if specific server clocks are only to be processed
+                        if (clock_ids.empty() || find(clock_ids.begin(), clock_ids.end(), oReceivedMessage.clock_id) != clock_ids.end()) 
                         {
                             // Set the timestamp unto the client time field
-                            oReceivedMessage->client_ts = TimeStamp;
+                            oReceivedMessage.client_ts = TimeStamp;
 
                             // Process the (client-time-stamped) received message
-                            ProcessReceivedMessage (oReceivedMessage);
+                            ProcessReceivedMessage (&oReceivedMessage);
                         }
                     }
                 }
@@ -153,22 +160,60 @@ private:
 
            // Set up the response message fields
            oResponseMsg.clock_id  = client_id;
+           oResponseMsg.server_id = poMsg->clock_id;
+           oResponseMsg.sequence  = poMsg->sequence;
            oResponseMsg.server_ts = poMsg->server_ts;
            oResponseMsg.client_ts = poMsg->client_ts;
-           oResponseMsg.checksum  = ComputeCheckSum(oResponseMsg);
+           oResponseMsg.checksum_kind = poMsg->checksum_kind;
+
+           // Spread the replies of the clients over the reply window of the broadcast: the reply is sent from a
+           // timer at the slot of this client, so broadcasts arriving meanwhile are still stamped on receipt (and
+           // the wait, after the receive time stamp, is not counted in the round trip)
+           if (poMsg->reply_window > 0)
+           {
+               uint64_t due_ns = poMsg->client_ts + static_cast<uint64_t>(GetReplySlot(client_id, poMsg->reply_window)) * 1000;
+               uint64_t now_ns = GetCurrentTime_ns();
+               if (due_ns > now_ns)
+               {
+                   shared_ptr<boost::asio::steady_timer> timer = make_shared<boost::asio::steady_timer>(io_service1);
+                   udp::endpoint server = sender_endpoint_;
+                   ClockWireFormat format = wire_format;
+
+                   timer->expires_from_now(chrono::nanoseconds(due_ns - now_ns));
+                   timer->async_wait([this, timer, oResponseMsg, server, format](const boost::system::error_code& error) mutable
+                   {
+                        if (!error)
+                        {
+                            SendReply(oResponseMsg, server, format);
+                        }
+                   });
+                   return;
+               }
+           }
 
            // Send response message
-           SendMessage(oResponseMsg);
+           SendReply(oResponseMsg, sender_endpoint_, wire_format);
       }
 
-      // Send Message to multicast server
-      bool SendMessage(ClockSyncMessage const &poMsg)
+      // Stamp the transmit time of a reply as late as possible and send it to the server of its broadcast
+      void SendReply (ClockSyncMessage & poMsg, udp::endpoint const & poServer, ClockWireFormat pFormat)
+      {
+           poMsg.client_tx_ts = GetCurrentTime_ns();
+           SendMessage(poMsg, poServer, pFormat);
+      }
+
+      // Send Message to multicast server (in the wire format of its broadcast)
+      bool SendMessage(ClockSyncMessage &poMsg, udp::endpoint const & poServer, ClockWireFormat pFormat)
       {
            // Check if socket is open
            if (socket_.is_open())
            {
+               // Encode the reply in the wire format of the broadcast
+               char frame[clock_wire_length];
+               size_t datalen = EncodeSyncMessage(poMsg, frame, sizeof(frame), pFormat);
+
                // Send sync message reply on the opened socket
-               socket_.send_to(boost::asio::buffer(&poMsg,sizeof(poMsg)), sender_endpoint_, 0, err);
+               socket_.send_to(boost::asio::buffer(frame, datalen), poServer, 0, err);
 
 #if !defined NO_PRINT
 	       // Indicate Message
@@ -198,22 +243,29 @@ int main (int argc, char* argv[])
        // Check for the required input
        if (argc < 2)
        {
-          cerr << "Usage: clock_client <client_id> [clock_id]";
+          cerr << "Usage: clock_client <client_id> [clock_id[,clock_id...]] [--time-source <realtime | monotonic-raw | tsc>]";
           return 1;
        }
 
        // Declare and read the required client_id 
-       uint32_t clock_id {0};
+       vector<uint32_t> clock_ids;
        uint32_t client_id = atoi(argv[1]);
 
-       // Check if the optional clock_id has been specified
-       if (argc > 2)
+       // Check if the optional clock ids have been specified (a clock id of 0 stands for any clock)
+       if (argc > 2 && argv[2][0] != '-')
+       {
+           clock_ids = ParseList(argv[2]);
+           clock_ids.erase(remove(clock_ids.begin(), clock_ids.end(), 0u), clock_ids.end());
+       }
+
+       // Select the source of the time stamps (default realtime)
+       if (!SelectTimeSource(GetCommandOption(argc, argv, "--time-source", "realtime")))
        {
-           clock_id = atoi(argv[2]);
+           return 1;
        }
 
        // Declare the client clock
-       clock_client clock (client_id, clock_id);
+       clock_client clock (client_id, clock_ids);
 
        // Start client receiving
        clock.StartReceiving ();
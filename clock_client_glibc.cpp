@@ -4,6 +4,14 @@
 #include <vector>
 #include <string>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <deque>
+#include <random>
+#include <algorithm>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -13,8 +21,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "clock_utils.hpp"
+#include "clock_wire.hpp"
 
 using namespace std;
 //
@@ -28,17 +38,22 @@ using namespace std;
 //
 class clock_client {
 
+protected:
+
         // Declare multicast port
         const short multicast_port {5000};
 
         // Declare multicast address
         const string cstrMulticastAddress {"238.10.50.50"};
 
+        // Declare the local interface joining the multicast group (default interface if empty)
+        string interface_address;
+
         // Declare client id 
         uint32_t client_id;
 
-        // Declare clock id 
-        uint32_t clock_id {0};
+        // Declare the clock ids answered (any clock if empty)
+        vector<uint32_t> clock_ids;
 
         // Declare file descriptor for socket i/o
         int sd;
@@ -51,13 +66,30 @@ class clock_client {
         enum { max_length = 256 };
         char data_[max_length];
 
+        // Declare the ancillary buffer of a received broadcast, carrying its kernel receive time stamp
+        char control_[CMSG_SPACE(sizeof(struct timespec))];
+
+        // Declare the wire format of the last broadcast (replies are sent in the same format)
+        ClockWireFormat wire_format {WIRE_CURRENT};
+
 public:
 
         // Constructor
-        clock_client (uint32_t pClientid, uint32_t pClockid) : client_id(pClientid), clock_id(pClockid) 
+        clock_client (uint32_t pClientid, vector<uint32_t> const & pClockIDs) : client_id(pClientid), clock_ids(pClockIDs) 
         {
         }
 
+        // Destructor
+        virtual ~clock_client ()
+        {
+        }
+
+        // Join the multicast group on the local interface with address psAddress (e.g. 127.0.0.1 for loopback only)
+        void SetInterface (string const & psAddress)
+        {
+             interface_address = psAddress;
+        }
+
         // Join multicast group and Start receiving messages
         void StartReceiving ()
         {
@@ -65,21 +97,42 @@ public:
              StartReceiving_impl();
 
              // Declare number of bytes received 
-             int msg_num {0};
              int bytes_recvd {0};
 
+             // Declare the receive header (data, sender address and ancillary buffers)
+             struct iovec iov;
+             iov.iov_base = data_;
+             iov.iov_len  = max_length;
+
+             struct msghdr header;
+             memset(&header, 0, sizeof(header));
+             header.msg_iov    = &iov;
+             header.msg_iovlen = 1;
+
              // Read incoming multicast data
-             while((bytes_recvd = recvfrom (sd, data_, sizeof(ClockSyncMessage), 0, &stMulticasterSourceIP, (socklen_t*) &nLen)) > -1)
+             while(true)
              {
-                // Process Received data in its handler
-                ReceiveHandler(bytes_recvd);
+                header.msg_name       = &stMulticasterSourceIP;
+                header.msg_namelen    = sizeof(stMulticasterSourceIP);
+                header.msg_control    = control_;
+                header.msg_controllen = sizeof(control_);
+
+                if ((bytes_recvd = recvmsg (sd, &header, 0)) < 0)
+                {
+                    break;
+                }
+                nLen = header.msg_namelen;
+
+                // Process Received data in its handler (time stamped by the kernel on receipt, however long
+                // the data waited in the socket buffer)
+                ReceiveHandler(bytes_recvd, GetReceiveTimeStamp(header));
 
                 // Reset reception buffer
                 memset(data_,0,max_length);
              }
         }
 
-private:
+protected:
 
         // Start Receiving multicast implementation
         void StartReceiving_impl()
@@ -128,9 +181,18 @@ private:
                  exit(EXIT_FAILURE);
              }
 
+             // Set option for kernel receive time stamps (nanoseconds) on every broadcast
+             int timestamp_ns = 1;
+             if (setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPNS, &timestamp_ns, sizeof(timestamp_ns)) < 0)
+             {
+                 cerr << "Error setsockopt receive time stamps" << endl;
+                 close(sd);
+                 exit(EXIT_FAILURE);
+             }
+
              // Join the multicast group
              group.imr_multiaddr.s_addr = inet_addr(cstrMulticastAddress.c_str());
-             group.imr_interface.s_addr = INADDR_ANY;
+             group.imr_interface.s_addr = interface_address.empty() ? htonl(INADDR_ANY) : inet_addr(interface_address.c_str());
              if (setsockopt(sd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&group, sizeof(group)) < 0)
              {
                  cerr << "Error setsockopt joining multicast group" << endl;
@@ -139,36 +201,48 @@ private:
              }
         }
 
-       // Event Handler for receiving multicast messages
-       void ReceiveHandler (int bytes_recvd)
+       // Get the kernel receive time stamp (in nanoseconds, moved to the time source) of a broadcast
+       // (or the current time if missing)
+       uint64_t GetReceiveTimeStamp (struct msghdr & poHeader)
+       {
+            for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&poHeader); cmsg != NULL; cmsg = CMSG_NXTHDR(&poHeader, cmsg))
+            {
+                 if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+                 {
+                     struct timespec ts;
+                     memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                     return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec + clock_time_source::GetTimeSource().GetRealtimeDifference();
+                 }
+            }
+
+            return GetCurrentTime_ns();
+       }
+
+       // Event Handler for receiving multicast messages (received at TimeStamp, nanoseconds)
+       void ReceiveHandler (int bytes_recvd, uint64_t TimeStamp)
        {
          try 
          {
-                // Get the immediate (client) time stamp when server message is received 
-                uint64_t TimeStamp = GetCurrentTimeSinceEpoch();
-                  
-                // Check if message is fully received
-                if (bytes_recvd == sizeof(ClockSyncMessage)) 
+                // Check if message is fully received and decode it
+                ClockSyncMessage oReceivedMessage;
+                if (bytes_recvd > 0 && DecodeSyncMessage(data_, bytes_recvd, oReceivedMessage, wire_format)) 
                 {
-                    // Get a pointer to the received sync message
-                    ClockSyncMessage* oReceivedMessage = reinterpret_cast<ClockSyncMessage*>(data_);
-
 #if !defined NO_PRINT
 		    // Indicate Received Message
-		    PrintSyncMessage(to_string(client_id) + "-recvd", *oReceivedMessage);
+		    PrintSyncMessage(to_string(client_id) + "-recvd", oReceivedMessage);
 #endif
                     // Validate the message's checksum before processing 
-                    // The previous message size check and current checksum validation ensures message integrity
-                    if (ValidateCheckSum (*oReceivedMessage)) 
+                    // The frame checks of the decoder and current checksum validation ensures message integrity
+                    if (ValidateCheckSum (oReceivedMessage)) 
                     {
-                        // Check if a specific server is only to be processed
-                        if (clock_id == 0 || clock_id == oReceivedMessage->clock_id) 
+                        // Check if specific server clocks are only to be processed
+                        if (clock_ids.empty() || find(clock_ids.begin(), clock_ids.end(), oReceivedMessage.clock_id) != clock_ids.end()) 
                         {
                             // Set the timestamp unto the client time field
-                            oReceivedMessage->client_ts = TimeStamp;
+                            oReceivedMessage.client_ts = TimeStamp;
 
                             // Process the (client-time-stamped) received message
-                            ProcessReceivedMessage (oReceivedMessage);
+                            ProcessReceivedMessage (&oReceivedMessage);
                         }
                     }
                 }
@@ -180,16 +254,34 @@ private:
       }
  
       // Process Received Message 
-      void ProcessReceivedMessage (ClockSyncMessage* poMsg) 
+      virtual void ProcessReceivedMessage (ClockSyncMessage* poMsg) 
       {
            // Declare response message
            ClockSyncMessage oResponseMsg;
 
            // Set up the response message fields
            oResponseMsg.clock_id  = client_id;
+           oResponseMsg.server_id = poMsg->clock_id;
+           oResponseMsg.sequence  = poMsg->sequence;
            oResponseMsg.server_ts = poMsg->server_ts;
            oResponseMsg.client_ts = poMsg->client_ts;
-           oResponseMsg.checksum  = ComputeCheckSum(oResponseMsg);
+
+           // Spread the replies of the clients over the reply window of the broadcast: wait for the slot
+           // of this client (after the receive time stamp, so the wait is not counted in the round trip;
+           // a broadcast arriving meanwhile keeps its kernel time stamp)
+           if (poMsg->reply_window > 0)
+           {
+               uint64_t due_ns = poMsg->client_ts + static_cast<uint64_t>(GetReplySlot(client_id, poMsg->reply_window)) * 1000;
+               uint64_t now_ns = GetCurrentTime_ns();
+               if (due_ns > now_ns)
+               {
+                   this_thread::sleep_for(chrono::nanoseconds(due_ns - now_ns));
+               }
+           }
+
+           // Stamp the transmit time as late as possible before sending
+           oResponseMsg.client_tx_ts  = GetCurrentTime_ns();
+           oResponseMsg.checksum_kind = poMsg->checksum_kind;
 
            // Send response message
            SendMessage(oResponseMsg);
@@ -201,9 +293,9 @@ private:
            // Check the validity of the descriptor
            if (sd > -1) 
            {
-               // Set up the response buffer
-               int datalen = sizeof(ClockSyncMessage);
-               char* dataptr_= reinterpret_cast<char*>(&poMsg);
+               // Encode the response in the wire format of the broadcast
+               char dataptr_[clock_wire_length];
+               size_t datalen = EncodeSyncMessage(poMsg, dataptr_, sizeof(dataptr_), wire_format);
 
                // Send client unicast response to multicast server 
                if (sendto(sd, dataptr_, datalen , 0, (struct sockaddr*)&stMulticasterSourceIP, nLen) < 0) 
@@ -225,6 +317,334 @@ private:
       }
 };
 
+//
+//***********************************************************************************************
+//
+// Class clock_simulator: Multicast listening client emulating a population of virtual clients
+//                        (with artificial clock skew and reply jitter) for load testing. Uses GLIBC.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_simulator : public clock_client {
+
+        // Declare a broadcast to answer: the (client-time-stamped) message, its wire format, the server
+        // address to reply to, its receive time and the number of replies to it not yet sent (or failed)
+        struct clock_broadcast
+        {
+               ClockSyncMessage msg;
+               ClockWireFormat format {WIRE_CURRENT};
+               struct sockaddr server_addr;
+               chrono::steady_clock::time_point received;
+               uint32_t unsent {0};
+        };
+
+        // Declare a reply of a virtual client to a broadcast (numbered in the order received), due at a time
+        struct clock_reply
+        {
+               chrono::steady_clock::time_point due;
+               uint64_t broadcast;
+               uint32_t client_id;
+        };
+
+        // Declare the reply worker state (each worker replies for a contiguous range of virtual clients)
+        struct clock_worker
+        {
+               // Declare the worker thread and its sending socket
+               thread oThread;
+               int sd {-1};
+
+               // Declare the range of virtual client ids handled by this worker
+               uint32_t first_id {0};
+               uint32_t count {0};
+
+               // Declare the broadcasts received and not yet taken by the worker (several hosted clocks
+               // broadcast back to back, while the worker is still answering earlier ones)
+               mutex mx;
+               condition_variable cv;
+               deque<clock_broadcast> queue;
+
+               // Declare the number of replies sent and of replies the socket failed to send (the server
+               // counts them as lost)
+               atomic<uint64_t> replies {0};
+               atomic<uint64_t> failed {0};
+        };
+
+        // Declare maximum number of replies per send call
+        enum { max_batch = 64 };
+
+        // Declare number of virtual clients
+        uint32_t clients;
+
+        // Declare maximum artificial clock skew (microseconds, applied as +/- per client)
+        uint32_t skew;
+
+        // Declare maximum reply jitter (microseconds, drawn per client and per broadcast)
+        uint32_t jitter;
+
+        // Declare the state of the simulator
+        atomic<bool> exec;
+
+        // Declare number of broadcasts received
+        uint64_t broadcasts {0};
+
+        // Declare reply workers
+        vector<unique_ptr<clock_worker>> workers;
+
+public:
+
+        // Constructor
+        clock_simulator (uint32_t pFirstClientid, vector<uint32_t> const & pClockIDs, uint32_t piClients, uint32_t piSkew, uint32_t piJitter, uint32_t piThreads) :
+
+                         clock_client (pFirstClientid, pClockIDs),
+                         clients      (piClients),
+                         skew         (piSkew),
+                         jitter       (piJitter),
+                         exec         (true)
+        {
+             // Split the virtual clients evenly among the workers
+             uint32_t threads = max(1u, min(piThreads, piClients));
+             uint32_t next_id = pFirstClientid;
+
+             for (uint32_t i=0; i<threads; i++)
+             {
+                  unique_ptr<clock_worker> worker (new clock_worker);
+                  worker->first_id = next_id;
+                  worker->count    = clients / threads + (i < clients % threads ? 1 : 0);
+                  next_id += worker->count;
+
+                  // Create the socket on which this worker sends its replies
+                  worker->sd = socket(AF_INET, SOCK_DGRAM, 0);
+                  if (worker->sd < 0)
+                  {
+                      cerr << "Error Opening datagram simulator socket" << endl;
+                      exit(EXIT_FAILURE);
+                  }
+
+                  workers.push_back(move(worker));
+             }
+
+             // Launch the workers
+             for (auto & worker : workers)
+             {
+                  worker->oThread = thread(&clock_simulator::ReplyWorker, this, worker.get());
+             }
+        }
+
+        // Destructor
+        ~clock_simulator ()
+        {
+             // Wake up and join the workers
+             exec.store(false, memory_order_release);
+
+             for (auto & worker : workers)
+             {
+                  {
+                      lock_guard<mutex> lock(worker->mx);
+                      worker->cv.notify_one();
+                  }
+
+                  if (worker->oThread.joinable())
+                  {
+                      worker->oThread.join();
+                  }
+
+                  close(worker->sd);
+             }
+        }
+
+protected:
+
+      // Process Received Message by queuing it to every reply worker
+      void ProcessReceivedMessage (ClockSyncMessage* poMsg) 
+      {
+           // Declare the broadcast with its receive time (the replies are due from then on)
+           clock_broadcast oBroadcast;
+           oBroadcast.msg         = *poMsg;
+           oBroadcast.format      = wire_format;
+           oBroadcast.server_addr = stMulticasterSourceIP;
+           oBroadcast.received    = chrono::steady_clock::now();
+
+           // Report the replies sent and failed so far (once per broadcast)
+           uint64_t replies {0};
+           uint64_t failed {0};
+           for (auto & worker : workers)
+           {
+                replies += worker->replies.load(memory_order_relaxed);
+                failed  += worker->failed.load(memory_order_relaxed);
+           }
+
+           cerr << "SIM: broadcast [" << ++broadcasts << "] clients [" << clients << "] replies sent [" << replies << "] failed [" << failed << "]" << endl;
+
+           // Dispatch the broadcast
+           for (auto & worker : workers)
+           {
+                lock_guard<mutex> lock(worker->mx);
+                worker->queue.push_back(oBroadcast);
+                worker->cv.notify_one();
+           }
+      }
+
+private:
+
+      // Get the artificial clock skew (microseconds) of a virtual client (fixed per client id)
+      int64_t GetClientSkew (uint32_t pClientid)
+      {
+           if (skew == 0)
+           {
+               return 0;
+           }
+
+           uint64_t hash = (pClientid + 0x9e3779b97f4a7c15ULL) * 0xbf58476d1ce4e5b9ULL;
+           hash ^= hash >> 31;
+
+           return static_cast<int64_t>(hash % (2 * static_cast<uint64_t>(skew) + 1)) - skew;
+      }
+
+      // Reply worker: answers every broadcast on behalf of its range of virtual clients
+      void ReplyWorker (clock_worker* poWorker)
+      {
+           // Declare random generator for reply jitter
+           mt19937 generator (poWorker->first_id);
+           uniform_int_distribution<uint32_t> distribution (0, jitter);
+
+           // Declare the broadcasts being answered (the first one numbered first_broadcast), the merged reply
+           // schedule of all of them ordered by due time (replies before next sent) and the send batch (with
+           // the broadcast of every reply)
+           deque<clock_broadcast> broadcasts, received;
+           uint64_t first_broadcast {0};
+           vector<clock_reply> schedule;
+           size_t next {0};
+           vector<char> frames (max_batch * clock_wire_length);
+           vector<struct mmsghdr> msgs (max_batch);
+           vector<struct iovec> iovecs (max_batch);
+           vector<clock_broadcast*> answered (max_batch);
+
+           while (true)
+           {
+                // Take the broadcasts received meanwhile, waiting for one while no reply is due
+                {
+                    unique_lock<mutex> lock(poWorker->mx);
+                    auto ready = [this, poWorker] { return !poWorker->queue.empty() || !exec.load(memory_order_acquire); };
+
+                    if (next == schedule.size())
+                    {
+                        poWorker->cv.wait(lock, ready);
+                    }
+                    else
+                    {
+                        poWorker->cv.wait_until(lock, schedule[next].due, ready);
+                    }
+
+                    if (!exec.load(memory_order_acquire))
+                    {
+                        return;
+                    }
+
+                    received.swap(poWorker->queue);
+                }
+
+                // Forget the broadcasts answered by every client (in the order received)
+                while (!broadcasts.empty() && broadcasts.front().unsent == 0)
+                {
+                     broadcasts.pop_front();
+                     first_broadcast++;
+                }
+
+                // Merge the replies to the broadcasts taken into the schedule: the reply delay of every virtual
+                // client is its slot in the reply window of the broadcast plus the jitter
+                if (!received.empty())
+                {
+                    schedule.erase(schedule.begin(), schedule.begin() + next);
+                    next = 0;
+
+                    for (auto & broadcast : received)
+                    {
+                         uint64_t number = first_broadcast + broadcasts.size();
+                         broadcast.unsent = poWorker->count;
+                         broadcasts.push_back(broadcast);
+
+                         for (uint32_t i=0; i<poWorker->count; i++)
+                         {
+                              uint32_t slot = broadcast.msg.reply_window > 0 ? GetReplySlot(poWorker->first_id + i, broadcast.msg.reply_window) : 0;
+                              schedule.push_back({broadcast.received + chrono::microseconds(slot + (jitter > 0 ? distribution(generator) : 0)), number, poWorker->first_id + i});
+                         }
+                    }
+                    received.clear();
+
+                    stable_sort(schedule.begin(), schedule.end(), [](clock_reply const & a, clock_reply const & b) { return a.due < b.due; });
+                }
+
+                // Collect every reply due by now (up to a batch)
+                auto now = chrono::steady_clock::now();
+                uint64_t transmit = GetCurrentTime_ns();
+                int batch {0};
+
+                while (next < schedule.size() && batch < max_batch && schedule[next].due <= now)
+                {
+                     clock_broadcast & broadcast = broadcasts[schedule[next].broadcast - first_broadcast];
+                     ClockSyncMessage const & oBroadcast = broadcast.msg;
+
+                     // Set up the response message of this virtual client (skewed time stamps in nanoseconds)
+                     int64_t skew_ns = GetClientSkew(schedule[next].client_id) * 1000;
+                     ClockSyncMessage oResponseMsg;
+                     oResponseMsg.clock_id  = schedule[next].client_id;
+                     oResponseMsg.server_id = oBroadcast.clock_id;
+                     oResponseMsg.sequence  = oBroadcast.sequence;
+                     oResponseMsg.server_ts = oBroadcast.server_ts;
+                     oResponseMsg.client_ts    = oBroadcast.client_ts + skew_ns;
+                     oResponseMsg.client_tx_ts  = transmit + skew_ns;
+                     oResponseMsg.checksum_kind = oBroadcast.checksum_kind;
+
+                     // Encode it into its slot of the batch (addressed to the server of its broadcast)
+                     char* frame = &frames[batch * clock_wire_length];
+                     iovecs[batch].iov_base = frame;
+                     iovecs[batch].iov_len  = EncodeSyncMessage(oResponseMsg, frame, clock_wire_length, broadcast.format);
+
+                     memset(&msgs[batch], 0, sizeof(struct mmsghdr));
+                     msgs[batch].msg_hdr.msg_iov     = &iovecs[batch];
+                     msgs[batch].msg_hdr.msg_iovlen  = 1;
+                     msgs[batch].msg_hdr.msg_name    = &broadcast.server_addr;
+                     msgs[batch].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+
+                     answered[batch] = &broadcast;
+                     batch++;
+                     next++;
+                }
+
+                // Send client unicast responses to multicast server: a partial send is resumed at the first
+                // reply not sent, and a reply failing to send is counted and skipped
+                int done {0};
+                while (done < batch)
+                {
+                     int sent = sendmmsg(poWorker->sd, &msgs[done], batch - done, 0);
+                     if (sent < 0 && errno == EINTR)
+                     {
+                         continue;
+                     }
+
+                     if (sent <= 0)
+                     {
+                         cerr << "Error in unicast sendmmsg from simulator" << endl;
+                         poWorker->failed.fetch_add(1, memory_order_relaxed);
+                         sent = 1;
+                     }
+                     else
+                     {
+                         poWorker->replies.fetch_add(sent, memory_order_relaxed);
+                     }
+
+                     for (int i=done; i<done + sent; i++)
+                     {
+                          answered[i]->unsent--;
+                     }
+                     done += sent;
+                }
+           }
+      }
+};
+
 // *****************************
 // Main entry point
 // *****************************
@@ -235,24 +655,51 @@ int main (int argc, char* argv[])
        // Check for the required input
        if (argc < 2)
        {
-          cerr << "Usage: clock_client <client_id> [clock_id]";
+          cerr << "Usage: clock_client <client_id> [clock_id[,clock_id...]] [--simulate <clients> [--skew <us>] [--jitter <us>] [--threads <n>]] [--interface <local address>] [--time-source <realtime | monotonic-raw | tsc>]";
           return 1;
        }
 
        // Declare and read the required client_id 
-       uint32_t clock_id {0};
+       vector<uint32_t> clock_ids;
        uint32_t client_id = atoi(argv[1]);
 
-       // Check if the optional clock_id has been specified
-       if (argc > 2)
+       // Check if the optional clock ids have been specified (a clock id of 0 stands for any clock)
+       if (argc > 2 && argv[2][0] != '-')
+       {
+           clock_ids = ParseList(argv[2]);
+           clock_ids.erase(remove(clock_ids.begin(), clock_ids.end(), 0u), clock_ids.end());
+       }
+
+       // Select the source of the time stamps (default realtime)
+       if (!SelectTimeSource(GetCommandOption(argc, argv, "--time-source", "realtime")))
+       {
+           return 1;
+       }
+
+       // Declare the local interface joining the multicast group (default any)
+       string interface_address = GetCommandOption(argc, argv, "--interface");
+
+       // Check if a population of virtual clients (ids starting at client_id) is to be simulated
+       uint32_t clients = atoi(GetCommandOption(argc, argv, "--simulate", "0").c_str());
+       if (clients > 0)
        {
-           clock_id = atoi(argv[2]);
+           // Declare the simulated clock population (skew and jitter in microseconds)
+           clock_simulator simulator (client_id, clock_ids, clients,
+                                      atoi(GetCommandOption(argc, argv, "--skew", "0").c_str()),
+                                      atoi(GetCommandOption(argc, argv, "--jitter", "0").c_str()),
+                                      atoi(GetCommandOption(argc, argv, "--threads", to_string(thread::hardware_concurrency())).c_str()));
+
+           // Start simulator receiving
+           simulator.SetInterface (interface_address);
+           simulator.StartReceiving ();
+           return 0;
        }
 
        // Declare the client clock
-       clock_client clock (client_id, clock_id);
+       clock_client clock (client_id, clock_ids);
 
        // Start client receiving
+       clock.SetInterface (interface_address);
        clock.StartReceiving ();
   }
   catch (exception& e)
@@ -0,0 +1,99 @@
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// Class clock_drift: Drift estimator of one client. Keeps an exponentially weighted least-squares
+//                    fit of offset (microseconds) against time (seconds), updated in O(1) per
+//                    sample from weighted means and co-moments; the slope is the frequency error
+//                    of the client in ppm (microseconds per second).
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+// Drift estimate of a client: fitted offset at the last sample, frequency error and residual jitter
+struct ClockDriftEstimate
+{
+       bool    valid {false};
+       int64_t offset {0};     // microseconds
+       double  ppm {0};
+       double  jitter {0};     // microseconds (weighted standard deviation of the residuals)
+};
+
+class clock_drift
+{
+        // Declare the minimum number of samples before the fit is reported
+        enum { min_samples = 3 };
+
+        // Declare the minimum weighted variance of the sample times (seconds squared) for a slope
+        static constexpr double min_time_variance {1e-6};
+
+        // Declare the time origin of the fit (nanoseconds) and the time of the last sample (seconds from it)
+        uint64_t origin_ns {0};
+        double last_t {0};
+        uint64_t samples {0};
+
+        // Declare the total weight, weighted means and co-moments of time and offset
+        double weight {0};
+        double mean_t {0};
+        double mean_y {0};
+        double c_tt {0};
+        double c_ty {0};
+        double c_yy {0};
+
+public:
+
+        // Constructor
+        clock_drift () {}
+
+        // Add a sample of offset pOffset (microseconds) taken at pTime_ns; the weight of earlier samples
+        // halves every pHalfLife seconds
+        void Add (uint64_t pTime_ns, int64_t pOffset, double pHalfLife)
+        {
+             if (samples == 0)
+             {
+                 origin_ns = pTime_ns;
+             }
+
+             double t = pTime_ns > origin_ns ? (pTime_ns - origin_ns) / 1e9 : 0.0;
+             double y = static_cast<double>(pOffset);
+
+             // Decay the earlier samples by the time elapsed since the last one
+             double decay = samples > 0 ? exp2(-max(t - last_t, 0.0) / pHalfLife) : 0.0;
+
+             // Weighted incremental update of the means and co-moments
+             weight = decay * weight + 1.0;
+             double dt = t - mean_t;
+             double dy = y - mean_y;
+             mean_t += dt / weight;
+             mean_y += dy / weight;
+             c_tt = decay * c_tt + dt * (t - mean_t);
+             c_ty = decay * c_ty + dt * (y - mean_y);
+             c_yy = decay * c_yy + dy * (y - mean_y);
+
+             last_t = max(t, last_t);
+             samples++;
+        }
+
+        // Get the estimate at the last sample (invalid until there are enough samples spread in time)
+        ClockDriftEstimate GetEstimate () const
+        {
+             ClockDriftEstimate estimate;
+             if (samples < min_samples || c_tt <= min_time_variance * weight)
+             {
+                 return estimate;
+             }
+
+             double slope    = c_ty / c_tt;
+             double residual = max(c_yy - slope * c_ty, 0.0) / weight;
+
+             estimate.valid  = true;
+             estimate.offset = llround(mean_y + slope * (last_t - mean_t));
+             estimate.ppm    = slope;
+             estimate.jitter = sqrt(residual);
+             return estimate;
+        }
+};
@@ -0,0 +1,290 @@
+#include <iostream>
+#include <string>
+#include <map>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <unistd.h>
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// Class clock_exporter: Serves the process metrics in the Prometheus text format from the event
+//                       loop of the server: over HTTP on a local TCP port ("port" or "addr:port"),
+//                       or as plain text on a Unix socket (a path), and dumps them to a file.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_exporter
+{
+        // Declare maximum size of an HTTP request read before answering
+        enum { max_request = 8192 };
+
+        // Declare the time a connection may take to send its request, or to take more of its response
+        // (seconds), and the period of the check (milliseconds)
+        enum { idle_timeout = 5, idle_check_ms = 1000 };
+
+        // Declare an open connection: its partial request, its response (once answered) with the part
+        // of it sent, and the time of its last progress (accepted, or response taken)
+        struct clock_connection
+        {
+               string request;
+               string response;
+               size_t sent {0};
+               bool answered {false};
+               chrono::steady_clock::time_point active;
+        };
+
+        // Declare the event loop serving the connections
+        clock_reactor & reactor;
+
+        // Declare the listening descriptor and its Unix socket path (if any)
+        int listen_fd {-1};
+        string unix_path;
+
+        // Declare the open connections
+        map<int, clock_connection> connections;
+
+public:
+
+        // Constructor
+        clock_exporter (clock_reactor & poReactor) : reactor(poReactor) {}
+
+        // Destructor
+        ~clock_exporter ()
+        {
+             for (auto & connection : connections)
+             {
+                  close(connection.first);
+             }
+
+             if (listen_fd > -1)
+             {
+                 close(listen_fd);
+             }
+
+             if (!unix_path.empty())
+             {
+                 unlink(unix_path.c_str());
+             }
+        }
+
+        // Listen on a Unix socket path or a local TCP "port" / "addr:port" (loopback by default)
+        void Listen (string const & psEndpoint)
+        {
+             if (psEndpoint.find('/') != string::npos)
+             {
+                 struct sockaddr_un addr;
+                 memset(&addr, 0, sizeof(addr));
+                 addr.sun_family = AF_UNIX;
+                 strncpy(addr.sun_path, psEndpoint.c_str(), sizeof(addr.sun_path) - 1);
+
+                 unix_path = psEndpoint;
+                 unlink(unix_path.c_str());
+
+                 listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                 if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+                 {
+                     cerr << "Error Binding metrics socket [" << psEndpoint << "]" << endl;
+                     exit(EXIT_FAILURE);
+                 }
+             }
+             else
+             {
+                 size_t colon = psEndpoint.rfind(':');
+                 string address = colon == string::npos ? "127.0.0.1" : psEndpoint.substr(0, colon);
+
+                 struct sockaddr_in addr;
+                 memset(&addr, 0, sizeof(addr));
+                 addr.sin_family      = AF_INET;
+                 addr.sin_addr.s_addr = inet_addr(address.c_str());
+                 addr.sin_port        = htons(atoi(psEndpoint.substr(colon == string::npos ? 0 : colon + 1).c_str()));
+
+                 int reuse = 1;
+                 listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                 if (listen_fd < 0 || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+                     bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+                 {
+                     cerr << "Error Binding metrics port [" << psEndpoint << "]" << endl;
+                     exit(EXIT_FAILURE);
+                 }
+             }
+
+             if (listen(listen_fd, 16) < 0)
+             {
+                 cerr << "Error Listening on metrics endpoint [" << psEndpoint << "]" << endl;
+                 exit(EXIT_FAILURE);
+             }
+
+             reactor.AddReader(listen_fd, bind(&clock_exporter::AcceptReady, this));
+             reactor.AddTimer(idle_check_ms, bind(&clock_exporter::ExpireConnections, this));
+        }
+
+        // Write the metrics to a file (replaced atomically, as read by textfile collectors)
+        static void Dump (string const & psFileName)
+        {
+             string temp_name = psFileName + ".tmp";
+             FILE* out_file = fopen(temp_name.c_str(), "w");
+             if (out_file == NULL)
+             {
+                 cerr << "Error Opening metrics file [" << temp_name << "]" << endl;
+                 return;
+             }
+
+             string metrics = clock_metrics::GetMetrics().FormatPrometheus();
+             bool written = fwrite(metrics.data(), 1, metrics.size(), out_file) == metrics.size();
+
+             if (fclose(out_file) != 0 || !written || rename(temp_name.c_str(), psFileName.c_str()) != 0)
+             {
+                 cerr << "Error Writing metrics file [" << psFileName << "]" << endl;
+             }
+        }
+
+private:
+
+        // Accept the pending connections (edge-triggered: until EAGAIN)
+        void AcceptReady ()
+        {
+             while (true)
+             {
+                  int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                  if (fd < 0)
+                  {
+                      if (errno == EINTR)
+                      {
+                          continue;
+                      }
+
+                      break;
+                  }
+
+                  // Unix socket readers get the metrics right away, HTTP clients once their request has been
+                  // read (the response is sent as the socket takes it)
+                  clock_connection & connection = connections[fd];
+                  connection.active = chrono::steady_clock::now();
+
+                  if (!unix_path.empty())
+                  {
+                      connection.response = clock_metrics::GetMetrics().FormatPrometheus();
+                      connection.answered = true;
+                  }
+
+                  reactor.AddReader(fd, bind(&clock_exporter::ConnectionReady, this, fd), true);
+             }
+        }
+
+        // Read the HTTP request of a connection, answer it with the metrics and send the response
+        void ConnectionReady (int fd)
+        {
+             clock_connection & connection = connections[fd];
+
+             if (!connection.answered)
+             {
+                 bool closed {false};
+                 char buffer[1024];
+
+                 while (true)
+                 {
+                      ssize_t n = read(fd, buffer, sizeof(buffer));
+                      if (n > 0)
+                      {
+                          connection.request.append(buffer, n);
+                          continue;
+                      }
+
+                      if (n < 0 && errno == EINTR)
+                      {
+                          continue;
+                      }
+
+                      closed = n == 0 || errno != EAGAIN;
+                      break;
+                 }
+
+                 // Wait for the end of the request headers
+                 string const & request = connection.request;
+                 bool complete = request.find("\r\n\r\n") != string::npos || request.find("\n\n") != string::npos || request.size() >= max_request;
+                 if (!complete)
+                 {
+                     if (closed)
+                     {
+                         Close(fd);
+                     }
+                     return;
+                 }
+
+                 string body = clock_metrics::GetMetrics().FormatPrometheus();
+                 connection.response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + to_string(body.size()) +
+                                       "\r\nConnection: close\r\n\r\n" + body;
+                 connection.answered = true;
+             }
+
+             // Send what the socket takes; the rest goes when it is writable again
+             if (!Send(fd, connection))
+             {
+                 Close(fd);
+             }
+        }
+
+        // Send the unsent part of the response of a connection (false once all sent, or on error)
+        static bool Send (int fd, clock_connection & connection)
+        {
+             while (connection.sent < connection.response.size())
+             {
+                  ssize_t n = send(fd, connection.response.data() + connection.sent, connection.response.size() - connection.sent, MSG_NOSIGNAL);
+                  if (n > 0)
+                  {
+                      connection.sent  += n;
+                      connection.active = chrono::steady_clock::now();
+                      continue;
+                  }
+
+                  if (n < 0 && errno == EINTR)
+                  {
+                      continue;
+                  }
+
+                  return n < 0 && errno == EAGAIN;
+             }
+
+             return false;
+        }
+
+        // Close the connections that did not send their request, or take more of their response, in time
+        void ExpireConnections ()
+        {
+             auto deadline = chrono::steady_clock::now() - chrono::seconds(idle_timeout);
+
+             vector<int> expired;
+             for (auto const & connection : connections)
+             {
+                  if (connection.second.active < deadline)
+                  {
+                      expired.push_back(connection.first);
+                  }
+             }
+
+             for (int fd : expired)
+             {
+                  Close(fd);
+             }
+        }
+
+        // Close a connection
+        void Close (int fd)
+        {
+             reactor.RemoveReader(fd);
+             connections.erase(fd);
+             close(fd);
+        }
+};
@@ -0,0 +1,51 @@
+#include <algorithm>
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// Class clock_filter: Minimum-delay clock filter of one client. Keeps the round-trip delays of
+//                     the last samples and rejects a sample whose delay exceeds the minimum of
+//                     the window by more than the tolerance (queueing or asymmetric paths inflate
+//                     the delay and the offset error together).
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_filter
+{
+public:
+
+        // Declare maximum number of delays kept
+        enum { max_window = 32 };
+
+private:
+
+        // Declare the delays of the last samples (circular)
+        int64_t delays[max_window];
+        uint32_t next {0};
+        uint32_t count {0};
+
+public:
+
+        // Constructor
+        clock_filter () {}
+
+        // Check a sample of round-trip delay pDelay; the delay enters the window either way
+        bool Accept (int64_t pDelay, uint32_t piWindow, int64_t piTolerance)
+        {
+             uint32_t window = min<uint32_t>(max<uint32_t>(piWindow, 1), max_window);
+
+             // Record the delay of this sample
+             delays[next] = pDelay;
+             next  = (next + 1) % window;
+             count = min(count + 1, window);
+
+             // Minimum delay of the window (this sample included)
+             int64_t min_delay = *min_element(delays, delays + count);
+
+             // Accept within the tolerance, or within half of the minimum delay on slow paths
+             return pDelay - min_delay <= max(piTolerance, min_delay / 2);
+        }
+};
@@ -0,0 +1,251 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "clock_utils.hpp"
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// clock_harness: Loopback end-to-end load test. For every step of a ramp of client populations
+//                and broadcast intervals, starts clock_server_glibc and a clock_client_glibc
+//                simulator on loopback multicast (no external network), waits for one warm-up
+//                statistics period and measures the next one: replies/sec, reply loss, reply
+//                latency percentiles (server receive time minus broadcast time), server CPU and
+//                the UDP datagrams the host dropped on full receive buffers.
+//                Results are printed one step per line as CSV.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+// Load of a server statistics period (parsed from its "STAT: Replies" line)
+struct ClockPeriodLoad
+{
+      unsigned long long valid      {0};
+      unsigned long long received   {0};
+      unsigned long long broadcasts {0};
+      long long p50 {0};
+      long long p90 {0};
+      long long p99 {0};
+      long long max {0};
+};
+
+// Start a process with its arguments; its stderr goes to pStderr (or /dev/null if negative)
+pid_t StartProcess (vector<string> const & poArgs, int pStderr)
+{
+     pid_t pid = fork();
+     if (pid < 0)
+     {
+         cerr << "Error Forking process [" << poArgs[0] << "]" << endl;
+         exit(EXIT_FAILURE);
+     }
+
+     if (pid == 0)
+     {
+         // Redirect the outputs (statistics lines of the server on stderr)
+         int null_fd = open("/dev/null", O_WRONLY);
+         dup2(null_fd, STDOUT_FILENO);
+         dup2(pStderr >= 0 ? pStderr : null_fd, STDERR_FILENO);
+
+         vector<char*> argv;
+         for (auto const & arg : poArgs)
+         {
+              argv.push_back(const_cast<char*>(arg.c_str()));
+         }
+         argv.push_back(NULL);
+
+         execv(argv[0], argv.data());
+         _exit(127);
+     }
+
+     return pid;
+}
+
+// Stop a process and reap it
+void StopProcess (pid_t pid)
+{
+     if (pid > 0)
+     {
+         kill(pid, SIGTERM);
+         waitpid(pid, NULL, 0);
+     }
+}
+
+// Get the cpu time (user and system, seconds) used so far by a process
+double GetProcessCpu (pid_t pid)
+{
+     ifstream stat_file ("/proc/" + to_string(pid) + "/stat");
+     string stat_line;
+     getline(stat_file, stat_line);
+
+     // Fields after the command name: state is field 3, utime and stime are fields 14 and 15
+     size_t name_end = stat_line.rfind(')');
+     if (name_end == string::npos)
+     {
+         return 0.0;
+     }
+
+     istringstream istring (stat_line.substr(name_end + 2));
+     string field;
+     unsigned long long utime {0}, stime {0};
+     for (int i=3; i<=13 && istring >> field; i++) {}
+     istring >> utime >> stime;
+
+     return static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// Get the number of UDP datagrams dropped so far on full receive buffers (host wide)
+unsigned long long GetUdpReceiveBufferErrors ()
+{
+     ifstream snmp_file ("/proc/net/snmp");
+     string header, values;
+
+     // The Udp: counters follow a line naming them
+     while (getline(snmp_file, header))
+     {
+          if (header.compare(0, 4, "Udp:") == 0 && getline(snmp_file, values))
+          {
+              istringstream names (header), counts (values);
+              string name, count;
+              while (names >> name && counts >> count)
+              {
+                   if (name == "RcvbufErrors")
+                   {
+                       return strtoull(count.c_str(), NULL, 10);
+                   }
+              }
+          }
+     }
+
+     return 0;
+}
+
+// Read server statistics lines up to the next period load (false if the server stopped)
+bool ReadPeriodLoad (FILE* poServer, ClockPeriodLoad & poLoad)
+{
+     char line[1024];
+
+     while (fgets(line, sizeof(line), poServer) != NULL)
+     {
+          if (sscanf(line, "STAT: Replies valid [%llu] received [%llu] broadcasts [%llu] latency us p50 [%lld] p90 [%lld] p99 [%lld] max [%lld]",
+                     &poLoad.valid, &poLoad.received, &poLoad.broadcasts, &poLoad.p50, &poLoad.p90, &poLoad.p99, &poLoad.max) == 7)
+          {
+              return true;
+          }
+     }
+
+     return false;
+}
+
+// ****************************
+// Main entry point
+// ****************************
+int main(int argc, char* argv[])
+{
+  try
+  {
+      // Check for help
+      if (HasCommandOption(argc, argv, "--help"))
+      {
+          cerr << "\nUsage: clock_harness [--clients <n,n,...>] [--intervals-ms <ms,ms,...>] [--period <secs>] [--threads <simulator threads>] [--jitter <us>] [--interface <local address>] [--collectors <server reply collectors>] [--reply-window <ms>] [--bin-dir <dir>]\n";
+          return -1;
+      }
+
+      // Declare the ramp (client populations and broadcast intervals) and the measured period
+      vector<uint32_t> populations = ParseList(GetCommandOption(argc, argv, "--clients", "100,500,1000,2000,5000"));
+      vector<uint32_t> intervals   = ParseList(GetCommandOption(argc, argv, "--intervals-ms", "1000,100"));
+      string period    = GetCommandOption(argc, argv, "--period", "3");
+      string threads   = GetCommandOption(argc, argv, "--threads", "2");
+      string jitter    = GetCommandOption(argc, argv, "--jitter", "1000");
+      string interface = GetCommandOption(argc, argv, "--interface", "127.0.0.1");
+      string bin_dir   = GetCommandOption(argc, argv, "--bin-dir", ".");
+      string collectors = GetCommandOption(argc, argv, "--collectors", "1");
+      string reply_window = GetCommandOption(argc, argv, "--reply-window", "0");
+
+      // Ignore a closed pipe from a stopped server
+      signal(SIGPIPE, SIG_IGN);
+
+      printf("clients,interval_ms,broadcasts,expected,valid,received,replies_per_sec,loss_pct,latency_p50_us,latency_p90_us,latency_p99_us,latency_max_us,server_cpu_pct,udp_rcvbuf_errors\n");
+      fflush(stdout);
+
+      for (uint32_t interval : intervals)
+      {
+           for (uint32_t clients : populations)
+           {
+                // Start the server with its statistics lines on a pipe (statistics file discarded)
+                int server_pipe[2];
+                if (pipe2(server_pipe, O_CLOEXEC) < 0)
+                {
+                    cerr << "Error Creating pipe" << endl;
+                    return -1;
+                }
+
+                vector<string> server_args {bin_dir + "/clock_server_glibc", "1", "--interval-ms", to_string(interval), "--stats-period", period,
+                                            "--interface", interface, "--trace", "0", "--output", "/dev/null", "--collectors", collectors,
+                                            "--reply-window", reply_window};
+
+                pid_t server = StartProcess(server_args, server_pipe[1]);
+                close(server_pipe[1]);
+                FILE* server_out = fdopen(server_pipe[0], "r");
+
+                // Start the simulated population once the server socket is up
+                this_thread::sleep_for(chrono::milliseconds(300));
+                pid_t simulator = StartProcess({bin_dir + "/clock_client_glibc", "1000", "--simulate", to_string(clients), "--threads", threads,
+                                                "--jitter", jitter, "--interface", interface}, -1);
+
+                // Skip the warm-up period, then measure the next one
+                ClockPeriodLoad load;
+                bool measured = ReadPeriodLoad(server_out, load);
+
+                auto start = chrono::steady_clock::now();
+                double cpu_start = GetProcessCpu(server);
+                unsigned long long drops_start = GetUdpReceiveBufferErrors();
+
+                measured = measured && ReadPeriodLoad(server_out, load);
+
+                double elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count() / 1e6;
+                double cpu = GetProcessCpu(server) - cpu_start;
+                unsigned long long drops = GetUdpReceiveBufferErrors() - drops_start;
+
+                StopProcess(simulator);
+                StopProcess(server);
+                fclose(server_out);
+
+                if (!measured)
+                {
+                    cerr << "Error Measuring step: clients [" << clients << "] interval ms [" << interval << "] (server stopped)" << endl;
+                    continue;
+                }
+
+                // Report the step
+                double expected = static_cast<double>(load.broadcasts) * clients;
+                double loss     = expected > 0 ? max(0.0, 1.0 - load.valid / expected) * 100.0 : 0.0;
+
+                printf("%u,%u,%llu,%.0f,%llu,%llu,%.0f,%.2f,%lld,%lld,%lld,%lld,%.1f,%llu\n", clients, interval, load.broadcasts, expected, load.valid, load.received,
+                       elapsed > 0 ? load.valid / elapsed : 0.0, loss, load.p50, load.p90, load.p99, load.max, elapsed > 0 ? cpu * 100.0 / elapsed : 0.0, drops);
+                fflush(stdout);
+           }
+      }
+  }
+  catch (exception& e)
+  {
+      cerr << e.what() << endl;
+  }
+
+  return 0;
+}
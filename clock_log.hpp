@@ -0,0 +1,314 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#if defined UNIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// Binary time-series log of statistics periods: fixed-width records appended to rotating
+// segments <prefix>.NNNNNN.bin, each starting with a small header. Records are stored in the
+// host (little-endian) byte order and in time order within and across segments.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+// Statistics record of one client for one period
+struct ClockLogRecord
+{
+      uint64_t timestamp_us;  // period time stamp (microseconds since epoch)
+      uint32_t clock_id;      // client id
+      uint32_t count;         // number of samples
+      int64_t  min;
+      int64_t  avg;
+      int64_t  median;
+      int64_t  max;
+      int64_t  p90;           // quantiles (valid if flags has quantiles_flag)
+      int64_t  p99;
+      int64_t  p999;
+      uint32_t flags;
+      uint32_t server_id;     // server clock (0 if the server hosts a single clock)
+};
+
+// Segment header
+struct ClockLogHeader
+{
+      char     magic[8];      // "CLKLOG\0\0"
+      uint32_t version;
+      uint32_t record_size;
+};
+
+static_assert(sizeof(ClockLogRecord) == 80, "ClockLogRecord must be fixed width");
+static_assert(sizeof(ClockLogHeader) == 16, "ClockLogHeader must be fixed width");
+
+// Record flags
+const uint32_t quantiles_flag {0x1};
+
+// Segment file format constants
+const char     clock_log_magic[8] {'C','L','K','L','O','G','\0','\0'};
+const uint32_t clock_log_version {1};
+
+#if defined UNIX
+
+//
+//***********************************************************************************************
+//
+// Class clock_log: Segment naming and rotation for the binary statistics log (append side)
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_log
+{
+        // Declare the segment path prefix
+        string prefix;
+
+        // Declare the maximum number of records per segment
+        uint64_t segment_records;
+
+        // Declare the current segment index and its number of records (as accepted by the writer), and
+        // both as they stand after the last buffer appended
+        uint32_t segment {0};
+        uint64_t records {0};
+        uint32_t appended_segment {0};
+        uint64_t appended_records {0};
+
+public:
+
+        // Constructor (continues the last existing segment of this prefix)
+        clock_log (string const & psPrefix, uint64_t piSegmentRecords = 1000000) :
+
+                   prefix          (psPrefix),
+                   segment_records (max<uint64_t>(piSegmentRecords, 1))
+        {
+             vector<uint32_t> segments = GetSegments(prefix);
+
+             if (segments.empty())
+             {
+                 segment = 1;
+                 return;
+             }
+
+             // Count the records already in the last segment
+             segment = segments.back();
+
+             struct stat st;
+             if (stat(GetSegmentName(prefix, segment).c_str(), &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(ClockLogHeader)))
+             {
+                 records = (st.st_size - sizeof(ClockLogHeader)) / sizeof(ClockLogRecord);
+             }
+        }
+
+        // Append a period of records to a buffer; returns the segment file the buffer belongs to. The records
+        // count in the segment once the writer accepted the buffer (Commit): a dropped buffer, header included,
+        // leaves the segments as they are on disk
+        string Append (vector<ClockLogRecord> const & poRecords, string & psBuffer)
+        {
+             appended_segment = segment;
+             appended_records = records;
+
+             // Rotate to a new segment when the current one is full
+             if (appended_records >= segment_records)
+             {
+                 appended_segment++;
+                 appended_records = 0;
+             }
+
+             // A new segment starts with its header
+             if (appended_records == 0)
+             {
+                 ClockLogHeader header;
+                 memcpy(header.magic, clock_log_magic, sizeof(header.magic));
+                 header.version     = clock_log_version;
+                 header.record_size = sizeof(ClockLogRecord);
+                 psBuffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+             }
+
+             psBuffer.append(reinterpret_cast<const char*>(poRecords.data()), poRecords.size() * sizeof(ClockLogRecord));
+             appended_records += poRecords.size();
+
+             return GetSegmentName(prefix, appended_segment);
+        }
+
+        // Count the records of the last buffer appended, accepted by the writer
+        void Commit ()
+        {
+             segment = appended_segment;
+             records = appended_records;
+        }
+
+        // Get the file name of a segment
+        static string GetSegmentName (string const & psPrefix, uint32_t piSegment)
+        {
+             char suffix[32];
+             snprintf(suffix, sizeof(suffix), ".%06u.bin", piSegment);
+             return psPrefix + suffix;
+        }
+
+        // Get the (sorted) indexes of the existing segments of a prefix
+        static vector<uint32_t> GetSegments (string const & psPrefix)
+        {
+             vector<uint32_t> segments;
+
+             // Split the prefix into directory and base name
+             size_t slash = psPrefix.find_last_of('/');
+             string sDirectory = slash == string::npos ? "." : psPrefix.substr(0, slash + 1);
+             string sBase      = slash == string::npos ? psPrefix : psPrefix.substr(slash + 1);
+
+             DIR* dir = opendir(sDirectory.c_str());
+             if (dir == NULL)
+             {
+                 return segments;
+             }
+
+             // Match <base>.NNNNNN.bin
+             struct dirent* entry;
+             while ((entry = readdir(dir)) != NULL)
+             {
+                  string sName (entry->d_name);
+                  unsigned index {0};
+                  char tail[8] {0};
+
+                  if (sName.size() > sBase.size() + 1 && sName.compare(0, sBase.size() + 1, sBase + ".") == 0 &&
+                      sscanf(sName.c_str() + sBase.size() + 1, "%u.%7s", &index, tail) == 2 && string(tail) == "bin")
+                  {
+                      segments.push_back(index);
+                  }
+             }
+
+             closedir(dir);
+             sort(segments.begin(), segments.end());
+
+             return segments;
+        }
+};
+
+//
+//***********************************************************************************************
+//
+// Class clock_log_reader: Memory-mapped range queries over the segments of a binary log
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_log_reader
+{
+        // Declare a mapped segment
+        struct clock_segment
+        {
+               void* base;
+               size_t length;
+               const ClockLogRecord* records;
+               size_t count;
+        };
+
+        // Declare the mapped segments (in time order)
+        vector<clock_segment> segments;
+
+public:
+
+        // Constructor (maps every valid segment of the prefix)
+        clock_log_reader (string const & psPrefix)
+        {
+             for (uint32_t index : clock_log::GetSegments(psPrefix))
+             {
+                  string sName = clock_log::GetSegmentName(psPrefix, index);
+
+                  int fd = open(sName.c_str(), O_RDONLY | O_CLOEXEC);
+                  if (fd < 0)
+                  {
+                      cerr << "Error Opening segment [" << sName << "]" << endl;
+                      continue;
+                  }
+
+                  struct stat st;
+                  if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(ClockLogHeader)))
+                  {
+                      close(fd);
+                      continue;
+                  }
+
+                  void* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+                  close(fd);
+
+                  if (base == MAP_FAILED)
+                  {
+                      cerr << "Error Mapping segment [" << sName << "]" << endl;
+                      continue;
+                  }
+
+                  // Validate the segment header
+                  const ClockLogHeader* header = static_cast<const ClockLogHeader*>(base);
+                  if (memcmp(header->magic, clock_log_magic, sizeof(header->magic)) != 0 || header->version != clock_log_version || header->record_size != sizeof(ClockLogRecord))
+                  {
+                      cerr << "Error Invalid segment header [" << sName << "]" << endl;
+                      munmap(base, st.st_size);
+                      continue;
+                  }
+
+                  clock_segment seg;
+                  seg.base    = base;
+                  seg.length  = st.st_size;
+                  seg.records = reinterpret_cast<const ClockLogRecord*>(static_cast<const char*>(base) + sizeof(ClockLogHeader));
+                  seg.count   = (st.st_size - sizeof(ClockLogHeader)) / sizeof(ClockLogRecord);
+                  segments.push_back(seg);
+             }
+        }
+
+        // Destructor
+        ~clock_log_reader ()
+        {
+             for (auto & seg : segments)
+             {
+                  munmap(seg.base, seg.length);
+             }
+        }
+
+        // Visit the records in [pFrom, pTo) (microseconds since epoch) of a client (0 for all clients)
+        // of a server clock (0 for all server clocks)
+        template <typename Visitor>
+        uint64_t Query (uint64_t pFrom, uint64_t pTo, uint32_t pClockID, uint32_t pServerID, Visitor visit) const
+        {
+             uint64_t matched {0};
+
+             for (auto const & seg : segments)
+             {
+                  // Skip segments entirely outside the window
+                  if (seg.count == 0 || seg.records[0].timestamp_us >= pTo || seg.records[seg.count - 1].timestamp_us < pFrom)
+                  {
+                      continue;
+                  }
+
+                  // Binary search the first record of the window (records are in time order)
+                  const ClockLogRecord* first = lower_bound(seg.records, seg.records + seg.count, pFrom,
+                                                            [](ClockLogRecord const & r, uint64_t t) { return r.timestamp_us < t; });
+
+                  for (const ClockLogRecord* r = first; r != seg.records + seg.count && r->timestamp_us < pTo; r++)
+                  {
+                       if ((pClockID == 0 || r->clock_id == pClockID) && (pServerID == 0 || r->server_id == pServerID))
+                       {
+                           visit(*r);
+                           matched++;
+                       }
+                  }
+             }
+
+             return matched;
+        }
+};
+#endif
@@ -0,0 +1,103 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <cstring>
+#include <cstdlib>
+
+#include "clock_utils.hpp"
+#include "clock_stats.hpp"
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// clock_log_reader: Range queries (by client and time window) over the binary statistics log
+//                   written by clock_server --binlog, exported in the clock_server.out CSV layout.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+// Parse a time given as microseconds since epoch or as a local "YYYY-mm-dd HH:MM:SS" datetime
+uint64_t ParseTime (string const & psTime, uint64_t pDefault)
+{
+     if (psTime.empty())
+     {
+         return pDefault;
+     }
+
+     // Local datetime edit
+     struct tm tm_time;
+     memset(&tm_time, 0, sizeof(tm_time));
+     if (strptime(psTime.c_str(), "%Y-%m-%d %H:%M:%S", &tm_time) != NULL)
+     {
+         tm_time.tm_isdst = -1;
+         return static_cast<uint64_t>(mktime(&tm_time)) * 1000000;
+     }
+
+     // Microseconds since epoch
+     return strtoull(psTime.c_str(), NULL, 10);
+}
+
+// ****************************
+// Main entry point
+// ****************************
+int main(int argc, char* argv[])
+{
+  try
+  {
+      // Check for the required input parameters
+      if (argc < 2)
+      {
+          cerr << "\nUsage: clock_log_reader <prefix> [--client <clock_id>] [--server <clock_id>] [--from <time>] [--to <time>] [--count]"
+               << "\n       <time>: microseconds since epoch or \"YYYY-mm-dd HH:MM:SS\" (local)\n";
+          return -1;
+      }
+
+      // Declare the query
+      string   prefix    = argv[1];
+      uint32_t client_id = atoi(GetCommandOption(argc, argv, "--client", "0").c_str());
+      uint32_t server_id = atoi(GetCommandOption(argc, argv, "--server", "0").c_str());
+      uint64_t from      = ParseTime(GetCommandOption(argc, argv, "--from"), 0);
+      uint64_t to        = ParseTime(GetCommandOption(argc, argv, "--to"), UINT64_MAX);
+      bool     count     = HasCommandOption(argc, argv, "--count");
+
+      // Map the log segments
+      clock_log_reader reader (prefix);
+
+      // Declare the edit of the current period time stamp (formatted once per period)
+      uint64_t last_timestamp {0};
+      string   sTimeStamp;
+
+      // Run the query, exporting the matching records in the clock_server.out layout
+      uint64_t matched = reader.Query(from, to, client_id, server_id, [&](ClockLogRecord const & record)
+      {
+           if (count)
+           {
+               return;
+           }
+
+           if (sTimeStamp.empty() || record.timestamp_us != last_timestamp)
+           {
+               last_timestamp = record.timestamp_us;
+               sTimeStamp     = FormatEpochTime_us(record.timestamp_us);
+           }
+
+           cout << sTimeStamp << "," << clock_stats::FormatClient(record) << "," << clock_stats::FormatStatistics(record) << "\n";
+      });
+
+      // Report the number of matching records if requested
+      if (count)
+      {
+          cout << matched << endl;
+      }
+  }
+  catch (exception& e)
+  {
+      cerr << e.what() << endl;
+  }
+
+  return 0;
+}
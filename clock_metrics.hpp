@@ -0,0 +1,335 @@
+#include <string>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// Self-instrumentation of the clock server: counters and latency histograms kept per thread
+// (each thread only writes its own cache lines, no atomic read-modify-write on the hot path)
+// and summed when exported in the Prometheus text format.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+// Counters
+enum ClockMetricCounter
+{
+     METRIC_BROADCASTS = 0,      // sync messages multicast
+     METRIC_BROADCAST_ERRORS,    // failed multicasts
+     METRIC_PACKETS_RECEIVED,    // datagrams read from the reply socket
+     METRIC_SIZE_MISMATCHES,     // datagrams that are not a valid frame (size, magic or version)
+     METRIC_CHECKSUM_FAILURES,   // frames failing checksum validation
+     METRIC_UNKNOWN_CLOCKS,      // replies to a server clock not hosted by this server
+     METRIC_REPLIES_ACCEPTED,    // replies added to the statistics
+     METRIC_REPLIES_FILTERED,    // replies discarded by the delay filter
+     METRIC_STATS_LOCK_WAITS,    // statistics shard locks found busy
+     METRIC_WRITER_DROPS,        // records dropped on a full writer queue
+     METRIC_ALERTS,              // alerts raised by the anomaly detector
+     METRIC_REPLIES_LATE,        // replies to a broadcast round already over
+     METRIC_REPLIES_DUPLICATE,   // replies to a broadcast round already answered
+     METRIC_ROUNDS_MISSED,       // broadcast rounds over without a reply of a client
+     METRIC_CLIENTS_EXPIRED,     // clients forgotten after the idle time
+     metric_counter_count
+};
+
+// Gauges (last value set by a single owner)
+enum ClockMetricGauge
+{
+     METRIC_KERNEL_DROPS = 0,    // datagrams dropped by the kernel on the reply socket (SO_RXQ_OVFL)
+     METRIC_PERIOD_CLIENTS,      // clients reported in the last statistics period
+     METRIC_ACTIVE_CLIENTS,      // clients registered (replied within the idle time)
+     metric_gauge_count
+};
+
+// Latency histograms
+enum ClockMetricLatency
+{
+     LATENCY_BROADCAST = 0,      // BroadcastMessage
+     LATENCY_RECEIVE,            // ReceiveHandler (sampled)
+     LATENCY_ADDPOINT,           // clock_stats::AddPoint (sampled)
+     LATENCY_LOCK_WAIT,          // wait for a busy statistics shard lock
+     LATENCY_RECORD,             // clock_stats::RecordStatistics
+     LATENCY_WRITE,              // clock_writer write of one record
+     metric_latency_count
+};
+
+//
+//***********************************************************************************************
+//
+// Class clock_metrics: Registry of the per-thread metric shards with the Prometheus exporter.
+//                      Histograms have power of two nanosecond buckets (64 ns to ~1 s); the
+//                      per-message ones are sampled (1 in 64 calls) to keep clock reads rare.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_metrics
+{
+public:
+
+        // Declare histogram layout (bucket i holds latencies below 2^(i + first_bucket_log2) ns)
+        enum { first_bucket_log2 = 6, bucket_count = 25 };
+
+        // Declare the sampling of the per-message histograms (1 in 2^sample_log2)
+        enum { sample_log2 = 6 };
+
+private:
+
+        // Declare the metrics written by one thread
+        struct clock_metrics_shard
+        {
+               atomic<uint64_t> counters[metric_counter_count];
+               atomic<uint64_t> buckets[metric_latency_count][bucket_count + 1];
+               atomic<uint64_t> sum_ns[metric_latency_count];
+               uint32_t sample_ticks[metric_latency_count] = {};
+
+               clock_metrics_shard ()
+               {
+                    for (auto & counter : counters) counter.store(0, memory_order_relaxed);
+                    for (auto & histogram : buckets) for (auto & bucket : histogram) bucket.store(0, memory_order_relaxed);
+                    for (auto & sum : sum_ns) sum.store(0, memory_order_relaxed);
+               }
+        };
+
+        // Declare the shards of all threads (kept after a thread exits so totals stay monotonic)
+        mutex mx;
+        vector<unique_ptr<clock_metrics_shard>> shards;
+
+        // Declare the gauges
+        atomic<int64_t> gauges[metric_gauge_count];
+
+public:
+
+        // Constructor
+        clock_metrics ()
+        {
+             for (auto & gauge : gauges) gauge.store(0, memory_order_relaxed);
+        }
+
+        // Get the metrics of the process
+        static clock_metrics & GetMetrics ()
+        {
+             static clock_metrics metrics;
+             return metrics;
+        }
+
+        // Add to a counter of the calling thread
+        static void Add (ClockMetricCounter pCounter, uint64_t piValue = 1)
+        {
+             Increment(GetShard().counters[pCounter], piValue);
+        }
+
+        // Set a gauge
+        static void Set (ClockMetricGauge pGauge, int64_t piValue)
+        {
+             GetMetrics().gauges[pGauge].store(piValue, memory_order_relaxed);
+        }
+
+        // Record a latency (nanoseconds) in a histogram of the calling thread
+        static void Record (ClockMetricLatency pLatency, uint64_t piLatency_ns)
+        {
+             clock_metrics_shard & shard = GetShard();
+             Increment(shard.buckets[pLatency][GetBucket(piLatency_ns)], 1);
+             Increment(shard.sum_ns[pLatency], piLatency_ns);
+        }
+
+        // Check if this call of a sampled histogram is to be timed
+        static bool Sample (ClockMetricLatency pLatency)
+        {
+             clock_metrics_shard & shard = GetShard();
+             return (shard.sample_ticks[pLatency]++ & ((1u << sample_log2) - 1)) == 0;
+        }
+
+        // Format all metrics in the Prometheus text exposition format
+        string FormatPrometheus ()
+        {
+             // Sum the shards (a scrape may race with writers; every value read is a valid past value)
+             uint64_t counters[metric_counter_count] = {};
+             uint64_t buckets[metric_latency_count][bucket_count + 1] = {};
+             uint64_t sum_ns[metric_latency_count] = {};
+             {
+                 lock_guard<mutex> lock(mx);
+                 for (auto & shard : shards)
+                 {
+                      for (int c=0; c<metric_counter_count; c++) counters[c] += shard->counters[c].load(memory_order_relaxed);
+                      for (int l=0; l<metric_latency_count; l++)
+                      {
+                           for (int b=0; b<=bucket_count; b++) buckets[l][b] += shard->buckets[l][b].load(memory_order_relaxed);
+                           sum_ns[l] += shard->sum_ns[l].load(memory_order_relaxed);
+                      }
+                 }
+             }
+
+             ostringstream ostring;
+
+             for (int c=0; c<metric_counter_count; c++)
+             {
+                  ostring << "# HELP " << GetName(static_cast<ClockMetricCounter>(c)) << " " << GetHelp(static_cast<ClockMetricCounter>(c)) << "\n"
+                          << "# TYPE " << GetName(static_cast<ClockMetricCounter>(c)) << " counter\n"
+                          << GetName(static_cast<ClockMetricCounter>(c)) << " " << counters[c] << "\n";
+             }
+
+             for (int g=0; g<metric_gauge_count; g++)
+             {
+                  ostring << "# HELP " << GetName(static_cast<ClockMetricGauge>(g)) << " " << GetHelp(static_cast<ClockMetricGauge>(g)) << "\n"
+                          << "# TYPE " << GetName(static_cast<ClockMetricGauge>(g)) << " gauge\n"
+                          << GetName(static_cast<ClockMetricGauge>(g)) << " " << gauges[g].load(memory_order_relaxed) << "\n";
+             }
+
+             for (int l=0; l<metric_latency_count; l++)
+             {
+                  string name = GetName(static_cast<ClockMetricLatency>(l));
+                  ostring << "# HELP " << name << " " << GetHelp(static_cast<ClockMetricLatency>(l)) << "\n"
+                          << "# TYPE " << name << " histogram\n";
+
+                  // Cumulative buckets with upper bounds in seconds
+                  uint64_t cumulative {0};
+                  for (int b=0; b<bucket_count; b++)
+                  {
+                       cumulative += buckets[l][b];
+                       ostring << name << "_bucket{le=\"" << static_cast<double>(1ULL << (b + first_bucket_log2)) / 1e9 << "\"} " << cumulative << "\n";
+                  }
+                  cumulative += buckets[l][bucket_count];
+
+                  ostring << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n"
+                          << name << "_sum " << sum_ns[l] / 1e9 << "\n"
+                          << name << "_count " << cumulative << "\n";
+             }
+
+             return ostring.str();
+        }
+
+private:
+
+        // Get the shard of the calling thread (registered on first use)
+        static clock_metrics_shard & GetShard ()
+        {
+             static thread_local clock_metrics_shard* shard = GetMetrics().Register();
+             return *shard;
+        }
+
+        // Register a new thread shard
+        clock_metrics_shard* Register ()
+        {
+             lock_guard<mutex> lock(mx);
+             shards.push_back(unique_ptr<clock_metrics_shard>(new clock_metrics_shard));
+             return shards.back().get();
+        }
+
+        // Increment a value written only by the owning thread (plain load and store, no locked instruction)
+        static void Increment (atomic<uint64_t> & pValue, uint64_t piValue)
+        {
+             pValue.store(pValue.load(memory_order_relaxed) + piValue, memory_order_relaxed);
+        }
+
+        // Get the histogram bucket of a latency
+        static int GetBucket (uint64_t piLatency_ns)
+        {
+             int log2 = piLatency_ns > 0 ? 63 - __builtin_clzll(piLatency_ns) : 0;
+             return min(max(log2 + 1 - static_cast<int>(first_bucket_log2), 0), static_cast<int>(bucket_count));
+        }
+
+        // Names and descriptions of the metrics
+        static const char* GetName (ClockMetricCounter pCounter)
+        {
+             static const char* names[metric_counter_count] = {
+                  "clock_broadcasts_total", "clock_broadcast_errors_total", "clock_packets_received_total",
+                  "clock_size_mismatches_total", "clock_checksum_failures_total", "clock_unknown_clocks_total",
+                  "clock_replies_accepted_total", "clock_replies_filtered_total", "clock_stats_lock_waits_total",
+                  "clock_writer_drops_total", "clock_alerts_total", "clock_replies_late_total",
+                  "clock_replies_duplicate_total", "clock_rounds_missed_total", "clock_clients_expired_total" };
+             return names[pCounter];
+        }
+
+        static const char* GetHelp (ClockMetricCounter pCounter)
+        {
+             static const char* help[metric_counter_count] = {
+                  "Sync messages multicast.", "Failed multicasts.", "Datagrams read from the reply socket.",
+                  "Datagrams that are not a valid sync message frame.", "Frames failing checksum validation.",
+                  "Replies to a server clock not hosted by this server.", "Replies added to the statistics.",
+                  "Replies discarded by the round-trip delay filter.", "Statistics shard locks found busy.",
+                  "Records dropped on a full writer queue.", "Alerts raised by the anomaly detector.",
+                  "Replies to a broadcast round already over.", "Replies to a broadcast round already answered.",
+                  "Broadcast rounds over without a reply of a tracked client.", "Clients forgotten after the idle time." };
+             return help[pCounter];
+        }
+
+        static const char* GetName (ClockMetricGauge pGauge)
+        {
+             static const char* names[metric_gauge_count] = { "clock_kernel_drops", "clock_period_clients", "clock_active_clients" };
+             return names[pGauge];
+        }
+
+        static const char* GetHelp (ClockMetricGauge pGauge)
+        {
+             static const char* help[metric_gauge_count] = {
+                  "Datagrams dropped by the kernel on the reply socket since it was opened.",
+                  "Clients reported in the last statistics period.", "Clients registered (replied within the idle time)." };
+             return help[pGauge];
+        }
+
+        static const char* GetName (ClockMetricLatency pLatency)
+        {
+             static const char* names[metric_latency_count] = {
+                  "clock_broadcast_seconds", "clock_receive_seconds", "clock_addpoint_seconds",
+                  "clock_stats_lock_wait_seconds", "clock_record_statistics_seconds", "clock_write_seconds" };
+             return names[pLatency];
+        }
+
+        static const char* GetHelp (ClockMetricLatency pLatency)
+        {
+             static const char* help[metric_latency_count] = {
+                  "Time to multicast a sync message.", "Time to decode, validate and process a reply (1 in 64 sampled).",
+                  "Time to add a point to the statistics (1 in 64 sampled).", "Wait for a busy statistics shard lock.",
+                  "Time to snapshot, summarize and queue a statistics period.", "Time to write one record to its file." };
+             return help[pLatency];
+        }
+};
+
+//
+//***********************************************************************************************
+//
+// Class clock_metrics_scope: Times its scope into a latency histogram (only when sampled).
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_metrics_scope
+{
+        // Declare the histogram and the start of the scope (unset if not sampled)
+        ClockMetricLatency latency;
+        bool timed;
+        chrono::steady_clock::time_point start;
+
+public:
+
+        // Constructor (pSampled: time only 1 in 64 scopes of this thread)
+        clock_metrics_scope (ClockMetricLatency pLatency, bool pSampled = false) :
+
+                             latency (pLatency),
+                             timed   (!pSampled || clock_metrics::Sample(pLatency))
+        {
+             if (timed)
+             {
+                 start = chrono::steady_clock::now();
+             }
+        }
+
+        // Destructor
+        ~clock_metrics_scope ()
+        {
+             if (timed)
+             {
+                 clock_metrics::Record(latency, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+             }
+        }
+};
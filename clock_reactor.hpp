@@ -0,0 +1,296 @@
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// Class clock_reactor: Single threaded epoll event loop driving periodic timers (timerfd) and
+//                      edge-triggered socket reads for the clock server. Uses GLIBC.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_reactor
+{
+        // Declare a registered event source (timer or reader)
+        struct clock_event
+        {
+               int  fd;
+               bool timer;
+               bool removed {false};
+               function<void(void)> func;
+
+               // Declare the timer period, next expected expiry and the lateness of its ticks
+               chrono::steady_clock::duration period;
+               chrono::steady_clock::time_point deadline;
+               ClockTimerLateness lateness;
+        };
+
+        // Declare maximum number of events handled per wakeup
+        enum { max_events = 64 };
+
+        // Declare the epoll descriptor
+        int epfd {-1};
+
+        // Declare the wakeup descriptor used to stop the loop from other threads
+        int wakefd {-1};
+
+        // Declare the state of the loop
+        atomic<bool> exec;
+
+        // Declare the registered event sources
+        vector<unique_ptr<clock_event>> events;
+
+        // Declare the number of event sources removed and not yet released
+        size_t removed_count {0};
+
+        // Declare the wakeup event
+        clock_event wake_event;
+
+public:
+
+        // Constructor
+        clock_reactor () : exec(false)
+        {
+             // Create the epoll instance
+             epfd = epoll_create1(EPOLL_CLOEXEC);
+             if (epfd < 0)
+             {
+                 cerr << "Error Creating epoll instance";
+                 exit(EXIT_FAILURE);
+             }
+
+             // Create the wakeup descriptor and watch it
+             wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+             if (wakefd < 0)
+             {
+                 cerr << "Error Creating wakeup eventfd";
+                 exit(EXIT_FAILURE);
+             }
+
+             wake_event.fd    = wakefd;
+             wake_event.timer = false;
+             Watch(&wake_event, EPOLLIN);
+        }
+
+        // Destructor
+        ~clock_reactor ()
+        {
+             // Release the timer descriptors owned by the reactor
+             for (auto & ev : events)
+             {
+                  if (ev->timer)
+                  {
+                      close(ev->fd);
+                  }
+             }
+
+             close(wakefd);
+             close(epfd);
+        }
+
+        // Add a periodic timer firing every piInterval milliseconds (first expiry after one interval)
+        int AddTimer (int piInterval, function<void(void)> func)
+        {
+             // Create the timer on the monotonic clock so wall clock steps do not move it
+             int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+             if (tfd < 0)
+             {
+                 cerr << "Error Creating timerfd";
+                 exit(EXIT_FAILURE);
+             }
+
+             // Arm the timer; the kernel keeps the period free of callback drift
+             struct itimerspec spec;
+             spec.it_interval.tv_sec  = piInterval / 1000;
+             spec.it_interval.tv_nsec = (piInterval % 1000) * 1000000L;
+             spec.it_value            = spec.it_interval;
+             if (timerfd_settime(tfd, 0, &spec, NULL) < 0)
+             {
+                 cerr << "Error Arming timerfd";
+                 exit(EXIT_FAILURE);
+             }
+
+             clock_event* ev = Register(tfd, true, EPOLLIN, func);
+             ev->period   = chrono::milliseconds(piInterval);
+             ev->deadline = chrono::steady_clock::now() + ev->period;
+
+             return tfd;
+        }
+
+        // Get the lateness statistics of a timer
+        ClockTimerLateness GetLateness (int pTimerFd) const
+        {
+             for (auto const & ev : events)
+             {
+                  if (ev->timer && ev->fd == pTimerFd)
+                  {
+                      return ev->lateness;
+                  }
+             }
+
+             return ClockTimerLateness();
+        }
+
+        // Add an edge-triggered reader (also called when the descriptor becomes writable, if pWritable);
+        // the callback must drain the descriptor until EAGAIN
+        void AddReader (int fd, function<void(void)> func, bool pWritable = false)
+        {
+             // Edge-triggered reads require a non-blocking descriptor
+             int flags = fcntl(fd, F_GETFL, 0);
+             if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+             {
+                 cerr << "Error Setting non-blocking descriptor";
+                 exit(EXIT_FAILURE);
+             }
+
+             Register(fd, false, EPOLLIN | EPOLLET | (pWritable ? EPOLLOUT : 0), func);
+        }
+
+        // Remove a reader before its descriptor is closed (safe from within any callback)
+        void RemoveReader (int fd)
+        {
+             for (auto & ev : events)
+             {
+                  if (!ev->timer && !ev->removed && ev->fd == fd)
+                  {
+                      epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+                      ev->removed = true;
+                      removed_count++;
+                      return;
+                  }
+             }
+        }
+
+        // Run the event loop on the calling thread until stopped
+        void Run ()
+        {
+             struct epoll_event ready[max_events];
+
+             exec.store(true, memory_order_release);
+
+             while (exec.load(memory_order_acquire))
+             {
+                  // Wait for the next timer expiry or socket readiness
+                  int n = epoll_wait(epfd, ready, max_events, -1);
+                  if (n < 0)
+                  {
+                      if (errno == EINTR)
+                      {
+                          continue;
+                      }
+
+                      cerr << "Error epoll_wait [" << strerror(errno) << "]";
+                      break;
+                  }
+
+                  // Dispatch every ready event source
+                  for (int i = 0; i < n; i++)
+                  {
+                       clock_event* ev = static_cast<clock_event*>(ready[i].data.ptr);
+
+                       // Skip sources removed by an earlier callback of this wakeup
+                       if (ev->removed)
+                       {
+                           continue;
+                       }
+
+                       // Stop request
+                       if (ev == &wake_event)
+                       {
+                           exec.store(false, memory_order_release);
+                           continue;
+                       }
+
+                       // Consume the timer expirations before invoking the callback
+                       if (ev->timer)
+                       {
+                           uint64_t expirations {0};
+                           if (read(ev->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                           {
+                               continue;
+                           }
+
+                           // Record the lateness against the first expiry (later ones were missed)
+                           int64_t late_us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - ev->deadline).count();
+                           ev->lateness.ticks++;
+                           ev->lateness.missed   += expirations - 1;
+                           ev->lateness.last_us   = late_us;
+                           ev->lateness.max_us    = max(ev->lateness.max_us, late_us);
+                           ev->lateness.total_us += late_us;
+                           ev->deadline += ev->period * expirations;
+                       }
+
+                       ev->func();
+                  }
+
+                  // Release the removed sources once no ready entry refers to them
+                  if (removed_count > 0)
+                  {
+                      events.erase(remove_if(events.begin(), events.end(), [](unique_ptr<clock_event> const & ev) { return ev->removed; }), events.end());
+                      removed_count = 0;
+                  }
+             }
+        }
+
+        // Stop the event loop (safe to call from any thread)
+        void Stop ()
+        {
+             uint64_t one {1};
+             if (write(wakefd, &one, sizeof(one)) < 0)
+             {
+                 cerr << "Error Waking event loop";
+             }
+        }
+
+        // Check if the event loop is running
+        bool is_running() const noexcept
+        {
+             return exec.load(memory_order_acquire);
+        }
+
+private:
+
+        // Register a new event source
+        clock_event* Register (int fd, bool pTimer, uint32_t pEvents, function<void(void)> func)
+        {
+             unique_ptr<clock_event> ev (new clock_event);
+             ev->fd    = fd;
+             ev->timer = pTimer;
+             ev->func  = func;
+
+             Watch(ev.get(), pEvents);
+             events.push_back(move(ev));
+
+             return events.back().get();
+        }
+
+        // Add an event source to the epoll interest list
+        void Watch (clock_event* ev, uint32_t pEvents)
+        {
+             struct epoll_event spec;
+             memset(&spec, 0, sizeof(spec));
+             spec.events   = pEvents;
+             spec.data.ptr = ev;
+             if (epoll_ctl(epfd, EPOLL_CTL_ADD, ev->fd, &spec) < 0)
+             {
+                 cerr << "Error Registering descriptor with epoll";
+                 exit(EXIT_FAILURE);
+             }
+        }
+};
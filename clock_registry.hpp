@@ -0,0 +1,214 @@
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// Class clock_registry: Registry of the live clients of a statistics shard. Maps a server clock
+//                       and client id pair to a dense slot on first contact and keeps the state
+//                       of every client contiguously by slot, so the per-client arrays of the
+//                       shard are indexed by slot instead of hashed. Clients silent for longer
+//                       than the idle time are released and their slots reused; when the fleet
+//                       shrinks to a quarter of the slots the clients are moved down, keeping
+//                       memory proportional to the active fleet.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+// State of a registered client: hosted server clock index it replies to (for its broadcast rounds),
+// last reply time (nanoseconds of the time source), replies since it registered and offset of its
+// last accepted reply (microseconds)
+struct ClockClientState
+{
+       bool     used {false};
+       uint32_t server_id {0};
+       uint32_t clock_id {0};
+       uint32_t clock_index {0};
+       uint64_t last_seen_ns {0};
+       uint64_t replies {0};
+       int64_t  last_offset {0};
+};
+
+// Client counts of a period: clients registered at its end, registered and expired in it
+struct ClockClientCounts
+{
+       uint64_t active {0};
+       uint64_t joined {0};
+       uint64_t expired {0};
+};
+
+class clock_registry
+{
+public:
+
+        // Declare the slot of no client
+        enum : uint32_t { no_slot = 0xffffffff };
+
+private:
+
+        // Declare the initial number of index entries (power of two)
+        enum { initial_capacity = 64 };
+
+        // Declare an index entry: hash of the server clock and client id pair (the pair itself is only
+        // compared, in the client state, when the hashes match) and its slot, no_slot if empty
+        struct clock_entry
+        {
+               uint32_t hash;
+               uint32_t slot;
+        };
+
+        // Declare the index (load factor under one half), the client states by slot, the released slots
+        // and the number of clients registered
+        vector<clock_entry> index;
+        vector<ClockClientState> clients;
+        vector<uint32_t> free_slots;
+        size_t active {0};
+
+public:
+
+        // Constructor
+        clock_registry () : index(initial_capacity, clock_entry {0, no_slot}) {}
+
+        // Get the slot of a client of a server clock (registered on first contact, poAdded then true)
+        uint32_t Register (uint32_t pServerID, uint32_t pClockID, bool & poAdded)
+        {
+             // Keep the load factor under one half
+             if ((active + 1) * 2 > index.size())
+             {
+                 Reindex(index.size() * 2);
+             }
+
+             size_t i = Find(pServerID, pClockID);
+             poAdded = index[i].slot == no_slot;
+             if (!poAdded)
+             {
+                 return index[i].slot;
+             }
+
+             // Reuse a released slot before growing
+             uint32_t slot;
+             if (!free_slots.empty())
+             {
+                 slot = free_slots.back();
+                 free_slots.pop_back();
+             }
+             else
+             {
+                 slot = static_cast<uint32_t>(clients.size());
+                 clients.emplace_back();
+             }
+
+             clients[slot] = ClockClientState();
+             clients[slot].used      = true;
+             clients[slot].server_id = pServerID;
+             clients[slot].clock_id  = pClockID;
+
+             index[i] = {Hash(pServerID, pClockID), slot};
+             active++;
+             return slot;
+        }
+
+        // Get the state of the client of a slot
+        ClockClientState & GetClient (uint32_t pSlot) { return clients[pSlot]; }
+
+        // Get the number of slots (the size of the per-client arrays) and of clients registered
+        size_t GetCapacity () const { return clients.size(); }
+        size_t GetActive () const { return active; }
+
+        // Release the clients last seen before pSince_ns (unless pKeep holds for their slot) and return
+        // their number; when under a quarter of the slots stay in use, the clients are moved down to the
+        // first slots and poMoved gets the new slot of every old slot (no_slot if released), else it is
+        // left empty
+        size_t Expire (uint64_t pSince_ns, function<bool(uint32_t)> const & pKeep, vector<uint32_t> & poMoved)
+        {
+             poMoved.clear();
+
+             size_t released {0};
+             for (uint32_t slot=0; slot<clients.size(); slot++)
+             {
+                  if (clients[slot].used && clients[slot].last_seen_ns < pSince_ns && !pKeep(slot))
+                  {
+                      clients[slot].used = false;
+                      free_slots.push_back(slot);
+                      released++;
+                  }
+             }
+
+             if (released == 0)
+             {
+                 return 0;
+             }
+             active -= released;
+
+             // Move the clients down when the slots are sparse
+             if (active * 4 < clients.size() && clients.size() > initial_capacity)
+             {
+                 poMoved.assign(clients.size(), no_slot);
+
+                 uint32_t next {0};
+                 for (uint32_t slot=0; slot<clients.size(); slot++)
+                 {
+                      if (clients[slot].used)
+                      {
+                          poMoved[slot]   = next;
+                          clients[next++] = clients[slot];
+                      }
+                 }
+
+                 clients.resize(next);
+                 clients.shrink_to_fit();
+                 vector<uint32_t>().swap(free_slots);
+             }
+
+             // Rebuild the index for the clients left
+             size_t size = initial_capacity;
+             while ((active + 1) * 2 > size)
+             {
+                  size *= 2;
+             }
+             Reindex(size);
+
+             return released;
+        }
+
+        // Hash a server clock and client id pair (well mixed so that sharding and probing use different bits)
+        static uint32_t Hash (uint32_t pServerID, uint32_t pClockID)
+        {
+             uint64_t h = ((static_cast<uint64_t>(pServerID) << 32) | pClockID) * 0x9e3779b97f4a7c15ull;
+             return static_cast<uint32_t>(h >> 32);
+        }
+
+private:
+
+        // Find the index entry of a client or the empty entry where it belongs (linear probing)
+        size_t Find (uint32_t pServerID, uint32_t pClockID) const
+        {
+             uint32_t hash = Hash(pServerID, pClockID);
+             size_t mask = index.size() - 1;
+             size_t i = hash & mask;
+
+             while (index[i].slot != no_slot && (index[i].hash != hash || clients[index[i].slot].clock_id != pClockID || clients[index[i].slot].server_id != pServerID))
+             {
+                  i = (i + 1) & mask;
+             }
+
+             return i;
+        }
+
+        // Rebuild the index with piSize entries (power of two) from the registered clients
+        void Reindex (size_t piSize)
+        {
+             vector<clock_entry> (piSize, clock_entry {0, no_slot}).swap(index);
+
+             for (uint32_t slot=0; slot<clients.size(); slot++)
+             {
+                  if (clients[slot].used)
+                  {
+                      index[Find(clients[slot].server_id, clients[slot].clock_id)] = {Hash(clients[slot].server_id, clients[slot].clock_id), slot};
+                  }
+             }
+        }
+};
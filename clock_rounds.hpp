@@ -0,0 +1,167 @@
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// Class clock_rounds: Broadcast round tracker of one client. Keeps a bitmap of the recent rounds
+//                     the client answered in time (a reply to the round being broadcast), tells
+//                     late replies (to an earlier round) and duplicates apart, and accounts the
+//                     rounds the client missed, either on its next reply or at the end of a
+//                     period for a client that went quiet.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+// Verdict on a reply to a broadcast round
+enum ClockRoundVerdict
+{
+     ROUND_ON_TIME = 0,  // first reply to the current round
+     ROUND_LATE,         // reply to an earlier round (the next broadcast went out first)
+     ROUND_DUPLICATE     // another reply to a round already answered
+};
+
+// Round counts of a period: replies in time, rounds missed, late and duplicate replies
+struct ClockRoundCounts
+{
+       uint64_t on_time {0};
+       uint64_t missed {0};
+       uint64_t late {0};
+       uint64_t duplicate {0};
+};
+
+class clock_rounds
+{
+public:
+
+        // Declare the number of recent rounds remembered (a client silent for as many is gone)
+        enum { window = 64 };
+
+private:
+
+        // Declare the latest round answered in time (0 before any), the bitmap of the rounds answered
+        // (bit i for round last - i) and the round up to which the missed rounds are accounted
+        uint32_t last {0};
+        uint64_t answered {0};
+        uint32_t accounted {0};
+
+public:
+
+        // Constructor
+        clock_rounds () {}
+
+        // Check a reply to round pSequence while round pRound is being broadcast; the rounds found
+        // missed since the last accounting are added to poMissed
+        ClockRoundVerdict Check (uint32_t pSequence, uint32_t pRound, uint64_t & poMissed)
+        {
+             // Replies to a round already answered, and to rounds over (never counted back as answered)
+             if (pSequence <= last && last - pSequence < window && (answered >> (last - pSequence) & 1) != 0)
+             {
+                 return ROUND_DUPLICATE;
+             }
+
+             if (pSequence < pRound)
+             {
+                 return ROUND_LATE;
+             }
+
+             // Account the rounds missed in between (a first reply starts the account)
+             uint32_t from = last > accounted ? last : accounted;
+             if (from > 0 && pSequence > from + 1)
+             {
+                 poMissed += pSequence - from - 1;
+             }
+             accounted = pSequence > accounted ? pSequence : accounted;
+
+             // Mark the round answered
+             if (pSequence > last)
+             {
+                 answered = pSequence - last < window ? answered << (pSequence - last) : 0;
+                 last = pSequence;
+             }
+             else if (last - pSequence >= window)
+             {
+                 return ROUND_ON_TIME;
+             }
+             answered |= 1ULL << (last - pSequence);
+
+             return ROUND_ON_TIME;
+        }
+
+        // Account the rounds over before round pRound (the current one) the client missed since its last
+        // reply; false once the client has missed the whole window, or never answered in time (its tracker
+        // can be dropped)
+        bool Close (uint32_t pRound, uint64_t & poMissed)
+        {
+             // Rounds past the window are not missed by a client that is gone
+             uint32_t from = last > accounted ? last : accounted;
+             uint32_t to   = pRound - 1 < last + window ? pRound - 1 : last + window;
+             if (from > 0 && pRound > from + 1 && to > from)
+             {
+                 poMissed += to - from;
+                 accounted = to;
+             }
+
+             return last > 0 && (pRound <= last || pRound - last <= window);
+        }
+};
+
+//
+//***********************************************************************************************
+//
+// Class clock_broadcasts: Broadcast log of a hosted server clock. The broadcasting thread records
+//                         every round it sends with its time; the reply collectors read the round
+//                         being broadcast, and the one that was being broadcast when a reply was
+//                         received, without locking.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_broadcasts
+{
+        // Declare the round being broadcast (0 before any) and the broadcast times of the recent rounds
+        // (nanoseconds of the time source, round r at r % window)
+        atomic<uint32_t> round;
+        atomic<uint64_t> times[clock_rounds::window];
+
+public:
+
+        // Constructor
+        clock_broadcasts () : round(0)
+        {
+             for (auto & time : times)
+             {
+                  time.store(0, memory_order_relaxed);
+             }
+        }
+
+        // Record the broadcast of round pRound at pTime_ns (the rounds before it are over)
+        void Start (uint32_t pRound, uint64_t pTime_ns)
+        {
+             times[pRound % clock_rounds::window].store(pTime_ns, memory_order_relaxed);
+             round.store(pRound, memory_order_release);
+        }
+
+        // Get the round being broadcast
+        uint32_t GetRound () const
+        {
+             return round.load(memory_order_acquire);
+        }
+
+        // Get the round being broadcast when a reply to round pSequence was received at pTime_ns (the round
+        // being broadcast now if the time is unknown): a reply is late only if the next round went out first,
+        // however long it then waited in the socket buffer
+        uint32_t GetRoundAt (uint32_t pSequence, uint64_t pTime_ns) const
+        {
+             uint32_t current = round.load(memory_order_acquire);
+             if (pTime_ns == 0 || pSequence >= current || current - pSequence >= clock_rounds::window)
+             {
+                 return current;
+             }
+
+             return times[(pSequence + 1) % clock_rounds::window].load(memory_order_relaxed) <= pTime_ns ? current : pSequence;
+        }
+};
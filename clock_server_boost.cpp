@@ -9,13 +9,17 @@
 #include <utility>
 #include <numeric>
 #include <iomanip>
+#include <sstream>
 #include <thread>
+#include <memory>
+#include <atomic>
   
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 
 #include "clock_utils.hpp"
+#include "clock_wire.hpp"
 #include "clock_stats.hpp"
 #include "clock_timer.hpp"
 
@@ -44,20 +48,26 @@ class clock_server :  public std::enable_shared_from_this<clock_server>{
         boost::system::error_code err;
         boost::asio::io_service io_service;
 
+        // Declare the strand serializing the broadcasts (posted from the broadcast timer thread)
+        boost::asio::io_service::strand strand;
+
         // Declare clock id 
         uint32_t clock_id;
 
         // Declare broadcasting period 
         uint32_t interval;
 
-        // Declare message count
-        uint64_t message_count {0};
+        // Declare message count (replies are handled on every thread of the pool)
+        atomic<uint64_t> message_count {0};
+
+        // Declare the number of threads running the io_service
+        uint32_t threads;
 
-        // Declare sender endpoint
-        shared_ptr<boost::asio::ip::udp::endpoint> sender_endpoint_;
+        // Declare the multicast group endpoint
+        boost::asio::ip::udp::endpoint multicast_endpoint;
 
-        // Declare receiver socket  
-        shared_ptr<boost::asio::ip::udp::socket> socket_;
+        // Declare the socket sending broadcasts and receiving replies (open for the server lifetime)
+        boost::asio::ip::udp::socket socket_;
 
 	// Declare the broadcast timer  
 	shared_ptr<clock_timer> oBroadcastTimer;
@@ -65,31 +75,54 @@ class clock_server :  public std::enable_shared_from_this<clock_server>{
 	// Declare the statistics timer  
 	shared_ptr<clock_timer> oStatisticsTimer ;
 
-        // Declare Outbound Buffer for broadcast messages 
+        // Declare Outbound Buffer for broadcast messages (in use until its send completes)
         enum { max_length = 256 };
         char data_[max_length];
+        bool sending {false};
+
+        // Declare the integrity function of the broadcasts
+        ClockCheckSumKind checksum_kind {CHECKSUM_CRC32C};
 
-        // Declare Inbound Buffer for client responses 
+        // Declare the window the clients spread their replies over (microseconds, 0 replies at once)
+        uint32_t reply_window_us {0};
+
+        // Declare Inbound Buffers for client responses (one per outstanding receive, with its sender)
         enum { max_length_recv = 4096 };
-        char recv_buffer_[max_length_recv];
+        struct clock_receive
+        {
+               char buffer[max_length_recv];
+               boost::asio::ip::udp::endpoint sender;
+        };
+        vector<unique_ptr<clock_receive>> receives;
 
         // Declare the statistics processor
         clock_stats stats;
 
 public:
 
-        // Constructor
-        clock_server (uint32_t pClockid, uint32_t piInterval) : 
+        // Constructor (piThreads threads run the io_service with piReceives receives outstanding)
+        clock_server (uint32_t pClockid, uint32_t piInterval, uint32_t piThreads = 1, uint32_t piReceives = 1) : 
 
-                      clock_id         (pClockid), 
-                      interval         (piInterval), 
-                      message_count    (0),
-                      sender_endpoint_ (make_shared<boost::asio::ip::udp::endpoint> (boost::asio::ip::address::from_string(multicast_address), multicast_port)),
-                      socket_          (make_shared<boost::asio::ip::udp::socket>(io_service, sender_endpoint_->protocol())),
-                      oBroadcastTimer  (make_shared<clock_timer>()), 
-                      oStatisticsTimer (make_shared<clock_timer>()) 
+                      strand             (io_service),
+                      clock_id           (pClockid), 
+                      interval           (piInterval), 
+                      threads            (max(piThreads, 1u)),
+                      multicast_endpoint (boost::asio::ip::address::from_string(multicast_address), multicast_port),
+                      socket_            (io_service, multicast_endpoint.protocol()),
+                      oBroadcastTimer    (make_shared<clock_timer>()), 
+                      oStatisticsTimer   (make_shared<clock_timer>()) 
 
         {
+             // Bind the socket to an ephemeral port up front so that replies can be received before the first broadcast
+             socket_.bind(boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), 0));
+
+             // Track the broadcast rounds of the clock (echoed by the replies of current clients)
+             stats.SetBroadcastClocks(1);
+
+             for (uint32_t i=0; i<max(piReceives, 1u); i++)
+             {
+                  receives.emplace_back(new clock_receive());
+             }
         } 
 
         // Destructor
@@ -108,50 +141,103 @@ public:
              }
         }
 
+        // Select the integrity function of the broadcasts (clients reply with the same one)
+        void SetCheckSumKind (ClockCheckSumKind pKind)
+        {
+             checksum_kind = pKind;
+        }
+
+        // Discard samples whose round-trip delay exceeds the client's recent minimum by more than the tolerance
+        void SetDelayFilter (uint32_t piWindow, int64_t piTolerance)
+        {
+             stats.SetDelayFilter(piWindow, piTolerance);
+        }
+
+        // Forget the clients silent for piIdle seconds (0 keeps them all)
+        void SetClientExpiry (uint32_t piIdle)
+        {
+             stats.SetClientExpiry(piIdle);
+        }
+
+        // Ask the clients to spread their replies over piWindow milliseconds after every broadcast (at most half
+        // the broadcast interval)
+        void SetReplyWindow (uint32_t piWindow)
+        {
+             reply_window_us = min<uint64_t>(piWindow * 1000ULL, interval * 500000ULL);
+             if (reply_window_us < piWindow * 1000ULL)
+             {
+                 cerr << "Reply window limited to half the broadcast interval [" << reply_window_us / 1000 << "] ms" << endl;
+             }
+        }
+
         // Start broadcasting and receiving reply messages
         void StartBroadcasting ()
         {
-             // Start receiving from clients
-             StartReceive();
+             // Start receiving from clients (every receive buffer outstanding)
+             for (auto & receive : receives)
+             {
+                  StartReceive(*receive);
+             }
 
              // Start stats timer (every minute)
              oStatisticsTimer->start(60*1000, bind(&clock_server::ProcessStatistics, this));
 
-             // Start broadcast timer (every interval seconds)
-             oBroadcastTimer->start(interval*1000, bind(&clock_server::StartBroadcasting_impl, this));
+             // Start broadcast timer (every interval seconds); the broadcast itself runs on the io_service
+             oBroadcastTimer->start(interval*1000, [this]() { strand.post(bind(&clock_server::StartBroadcasting_impl, this)); });
+
+             // Run the service on the pool (the calling thread included)
+             vector<thread> pool;
+             for (uint32_t i=1; i<threads; i++)
+             {
+                  pool.emplace_back([this]() { io_service.run(); });
+             }
 
-             // Run the service
              io_service.run();
+
+             for (auto & worker : pool)
+             {
+                  worker.join();
+             }
         }
 
 private:
 
-       // Implementation of Sync Message broadcasting 
+       // Implementation of Sync Message broadcasting (on the strand)
        void StartBroadcasting_impl  ()
        {
-             // Set up Receive Handler
-             SetupReceiveHandler();
+             // Skip this tick if the previous broadcast is still being sent (its buffer is in use)
+             if (sending)
+             {
+                 cerr << "Message NOT broadcast: previous broadcast still pending [" << message_count << "]" << endl;
+                 return;
+             }
+
+             // Build a broadcast message of the next round (replies to earlier rounds are late from now on)
+             ClockSyncMessage oBroadcastMessage = BuildBroadcastMessage(stats.GetRound(0) + 1);
+             stats.SetRound(0, oBroadcastMessage.sequence, oBroadcastMessage.server_ts);
 
-             // Build a broadcast message 
-             ClockSyncMessage oBroadcastMessage = BuildBroadcastMessage();
+             // Encode the message into the outbound buffer (kept alive until the send completes)
+             size_t datalen = EncodeSyncMessage(oBroadcastMessage, data_, max_length);
+             sending = true;
 
-             // Indicate message has been built
-             PrintSyncMessage("BUILT",oBroadcastMessage);
+             // Indicate message has been built (with the checksum of its frame)
+             TraceSyncMessage(TRACE_BROADCAST, TRACE_BUILT, 0, oBroadcastMessage);
 
-             // Multicast the message on the sender socket
-             socket_->async_send_to( 
-                                     boost::asio::buffer(&oBroadcastMessage,sizeof(ClockSyncMessage)),  
-                                     *sender_endpoint_,
-                                     boost::bind(&clock_server::PostSendHandler, this, boost::asio::placeholders::error)
-                                   );
+             // Multicast the message on the long-lived socket
+             socket_.async_send_to( 
+                                    boost::asio::buffer(data_, datalen),  
+                                    multicast_endpoint,
+                                    strand.wrap(boost::bind(&clock_server::PostSendHandler, this, boost::asio::placeholders::error))
+                                  );
 
        }
 
-       // Event Handler post sending of multicast message
+       // Event Handler post sending of multicast message (on the strand)
        void PostSendHandler (const boost::system::error_code& error)
        {
             // Just increment the number of successful messages sent
             ++message_count;
+            sending = false;
 
 
             if (!error)
@@ -165,104 +251,91 @@ private:
 
        }
 
-       // Start reception of udp content by setting async callback processing
-       void StartReceive ()
+       // Start reception of udp content into a receive buffer by setting async callback processing
+       void StartReceive (clock_receive & poReceive)
        {
-            // Process the incoming udp payload asynchronously
-             socket_->async_receive_from (
+            // Process the incoming udp payload asynchronously (receive handlers run on any thread of the pool)
+            socket_.async_receive_from (
 
-                        boost::asio::buffer(recv_buffer_),
-                        *sender_endpoint_,
-                        boost::bind(&clock_server::ReceiveHandler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)
+                        boost::asio::buffer(poReceive.buffer),
+                        poReceive.sender,
+                        boost::bind(&clock_server::ReceiveHandler, this, boost::ref(poReceive), boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)
             );
        }
 
-       // Receive Handler of incoming reply messages
-       void ReceiveHandler (const boost::system::error_code& error, size_t bytes_recvd)
+       // Receive Handler of incoming reply messages (one receive buffer, concurrently with the others)
+       void ReceiveHandler (clock_receive & poReceive, const boost::system::error_code& error, size_t bytes_recvd)
        {
-            // Lock while processing data 
-            mutex omutex;
-            lock_guard<mutex> lock(omutex);
+            // Stop receiving once the socket is closed
+            if (error == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
 
             // Check for errors
             if (!error)
             {
                 // Get the immediate (client) time stamp when server message is received
-                uint64_t FinalTimeStamp = GetCurrentTimeSinceEpoch();
+                uint64_t FinalTimeStamp = GetCurrentTime_ns();
 
-                // Check if message is fully received
-                if (bytes_recvd == sizeof(ClockSyncMessage))
+                // Check if message is fully received and decode it
+                ClockSyncMessage oReceivedMessage;
+                if (DecodeSyncMessage(poReceive.buffer, bytes_recvd, oReceivedMessage))
                 {
-                    // Get a pointer to the received sync message
-                    ClockSyncMessage* oReceivedMessage = reinterpret_cast<ClockSyncMessage*>(recv_buffer_);
-                  
                     // Validate the message before processing (in case of mangling per packet drops)
-                    if (ValidateCheckSum (*oReceivedMessage))
+                    if (ValidateCheckSum (oReceivedMessage))
                     {
                         // Process the (client-time-stamped) received message
-                        ProcessReceivedMessage (*oReceivedMessage, FinalTimeStamp);
+                        ProcessReceivedMessage (oReceivedMessage, FinalTimeStamp);
                     }
-
-                    // Clear the buffer
-                    memset (recv_buffer_,0,max_length_recv);
                 }
- 
-                // Continue async reads
-                socket_->async_receive_from ( 
-                                              boost::asio::buffer(recv_buffer_),
-                                              *sender_endpoint_,
-                                              boost::bind(&clock_server::ReceiveHandler, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)
-                                            );
             }
             else 
             {
                 // Write the legend
-                this_thread::sleep_for(chrono::milliseconds(10));
                 cerr << "Error [" << error << "] Msg [" << error.message() << "]\n";
-
-#if !defined NO_PRINT
-                cerr << "\nMulticasting...\n";
-#endif
-
             }
-       }
-
-       // Sets up receive handler for clock client responses
-       void SetupReceiveHandler () 
-       {
-             // Reset endpoint              
-             socket_->close();
-             sender_endpoint_ = make_shared<boost::asio::ip::udp::endpoint> (boost::asio::ip::address::from_string(multicast_address), multicast_port);
-             socket_          = make_shared<boost::asio::ip::udp::socket>(io_service, sender_endpoint_->protocol());
 
-             // Set up receive handler for response messages
-             StartReceive();
+            // Continue async reads into this buffer
+            StartReceive(poReceive);
        }
 
        // Process received Sync message from clients
        void ProcessReceivedMessage (ClockSyncMessage const & poReceivedMsg, uint64_t pFinalTimeStamp)
        {
+            // Drop the replies to other servers' clocks (replies of earlier clients carry no server clock)
+            if (poReceivedMsg.server_id != 0 && poReceivedMsg.server_id != clock_id)
+            {
+                clock_metrics::Add(METRIC_UNKNOWN_CLOCKS);
+                return;
+            }
+
             // Print message received from client
-            PrintSyncMessage("PROCD("+to_string(message_count)+")",poReceivedMsg);
+            TraceSyncMessage(TRACE_MESSAGES, TRACE_PROCD, message_count, poReceivedMsg);
 
-            // Compute the offset
-            int64_t offset_us = (pFinalTimeStamp + poReceivedMsg.server_ts)/2 - poReceivedMsg.client_ts;
+            // Compute the offset and the round-trip delay from the four time stamps (nanoseconds, rounded once)
+            int64_t offset_us = RoundToMicroseconds (ComputeOffset (poReceivedMsg, pFinalTimeStamp));
+            int64_t delay_us  = RoundToMicroseconds (ComputeDelay (poReceivedMsg, pFinalTimeStamp));
 
-            // Add offset for this client to the stats processor
-            stats.AddPoint (poReceivedMsg.clock_id, offset_us);
+            // Add offset for this client to the stats processor (unless its delay is filtered out, or it is a
+            // duplicate reply, or a reply received once the next round went out)
+            stats.AddPoint (0, poReceivedMsg.clock_id, offset_us, delay_us, pFinalTimeStamp, poReceivedMsg.sequence, 0);
        }
  
-       // Build Sync Message to be broadcast
-       ClockSyncMessage BuildBroadcastMessage (void) 
+       // Build Sync Message of a round to be broadcast
+       ClockSyncMessage BuildBroadcastMessage (uint32_t pSequence) 
        {
            // Declare response message
            ClockSyncMessage oBroadcastMsg;
 
            // Set up the broadcast message
            oBroadcastMsg.clock_id  = clock_id;
-           oBroadcastMsg.server_ts = GetCurrentTimeSinceEpoch();
+           oBroadcastMsg.server_ts = GetCurrentTime_ns();
            oBroadcastMsg.client_ts = 0;
-           oBroadcastMsg.checksum  = ComputeCheckSum(oBroadcastMsg);
+           oBroadcastMsg.client_tx_ts = 0;
+           oBroadcastMsg.reply_window = reply_window_us;
+           oBroadcastMsg.sequence  = pSequence;
+           oBroadcastMsg.checksum_kind = checksum_kind;
 
            // return built message 
            return oBroadcastMsg;
@@ -273,9 +346,31 @@ private:
        {
             // Indicate a new statistics period
             cerr << "\nSTAT: Persisting Statistcs for this last minute ... \n";
+            cerr << "STAT: Broadcast timer " << FormatLateness(oBroadcastTimer->GetLateness()) << "\n";
 
             // Persist statistics to file
             stats.RecordStatistics();
+
+            // Indicate the samples discarded by the delay filter
+            pair<uint64_t, uint64_t> filter_counts = stats.GetFilterCounts();
+            if (filter_counts.first > 0)
+            {
+                cerr << "STAT: Delay filter rejected [" << filter_counts.second << "] of [" << filter_counts.first << "] samples\n";
+            }
+
+            // Indicate the live fleet of clients (joined and forgotten in the period)
+            ClockClientCounts client_counts = stats.GetClientCounts();
+            cerr << "STAT: Clients active [" << client_counts.active << "] joined [" << client_counts.joined << "] expired [" << client_counts.expired << "]\n";
+
+            // Indicate the replies to the broadcast rounds of the period
+            ClockRoundCounts round_counts = stats.GetRoundCounts();
+            if (round_counts.on_time + round_counts.missed + round_counts.late + round_counts.duplicate > 0)
+            {
+                ostringstream loss;
+                loss << fixed << setprecision(2) << (round_counts.on_time + round_counts.missed > 0 ? 100.0 * round_counts.missed / (round_counts.on_time + round_counts.missed) : 0.0);
+                cerr << "STAT: Rounds answered [" << round_counts.on_time << "] missed [" << round_counts.missed << "] loss [" << loss.str()
+                     << "%] late [" << round_counts.late << "] duplicate [" << round_counts.duplicate << "]\n";
+            }
        }
 };
 
@@ -289,7 +384,7 @@ int main(int argc, char* argv[])
       // Check for the required input parameters
       if (argc < 2)
       {
-          cerr << "\nUsage: clock_server <clock_id> [interval]\n";
+          cerr << "\nUsage: clock_server <clock_id> [interval] [--trace <0 off | 1 broadcasts | 2 all messages>] [--filter-window <n, 0 off>] [--filter-tolerance <us>] [--client-idle <secs, 0 never>] [--reply-window <ms>] [--checksum <wordsum | crc32c>] [--time-source <realtime | monotonic-raw | tsc>] [--threads <n>] [--receives <outstanding receives>]\n";
           return -1;
       }
 
@@ -298,13 +393,49 @@ int main(int argc, char* argv[])
       uint32_t clock_id = atoi(argv[1]);
 
       // Check if the optional interval has been specified
-      if (argc > 2)
+      if (argc > 2 && argv[2][0] != '-')
       {
           interval = atoi(argv[2]);
       }
 
+      // Set the trace verbosity (default from CLOCK_TRACE, else broadcasts only)
+      string trace_level = GetCommandOption(argc, argv, "--trace");
+      if (!trace_level.empty())
+      {
+          clock_trace::GetTrace().SetLevel(atoi(trace_level.c_str()));
+      }
+
+      // Select the source of the time stamps before any thread reads it (default realtime)
+      if (!SelectTimeSource(GetCommandOption(argc, argv, "--time-source", "realtime")))
+      {
+          return -1;
+      }
+
+      // Declare the io_service threads and the receives outstanding (default one each; at least one receive per thread)
+      uint32_t threads  = max(atoi(GetCommandOption(argc, argv, "--threads", "1").c_str()), 1);
+      uint32_t receives = max<uint32_t>(atoi(GetCommandOption(argc, argv, "--receives", "0").c_str()), threads);
+
       // Declare the multicast clock server object
-      clock_server clock (clock_id, interval);
+      clock_server clock (clock_id, interval, threads, receives);
+
+      // Set the round-trip delay filter (default minimum of the last 8 delays, 200 us tolerance)
+      clock.SetDelayFilter(atoi(GetCommandOption(argc, argv, "--filter-window", "8").c_str()), atoll(GetCommandOption(argc, argv, "--filter-tolerance", "200").c_str()));
+
+      // Forget the clients silent for the idle time (default 10 minutes, 0 never)
+      clock.SetClientExpiry(atoi(GetCommandOption(argc, argv, "--client-idle", "600").c_str()));
+
+      // Set the window the clients spread their replies over (default none, replies at once)
+      clock.SetReplyWindow(atoi(GetCommandOption(argc, argv, "--reply-window", "0").c_str()));
+
+      // Set the integrity function of the broadcasts (replies use the same one; default CRC32C)
+      string checksum_name = GetCommandOption(argc, argv, "--checksum", "crc32c");
+      ClockCheckSumKind checksum_kind {CHECKSUM_CRC32C};
+      if (!ParseCheckSumName(checksum_name, checksum_kind))
+      {
+          cerr << "\nUnknown checksum [" << checksum_name << "]: wordsum or crc32c\n";
+          return -1;
+      }
+      clock.SetCheckSumKind(checksum_kind);
 
       // Start multicasting from the clock server
       clock.StartBroadcasting ();
@@ -13,9 +13,16 @@
 #include <thread>
 #include <cstring>
 #include <functional>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <climits>
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <linux/filter.h>
+#include <pthread.h>
+#include <sched.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <stdio.h>
@@ -23,8 +30,10 @@
 #include <unistd.h>
   
 #include "clock_utils.hpp"
+#include "clock_wire.hpp"
 #include "clock_stats.hpp"
-#include "clock_timer.hpp"
+#include "clock_reactor.hpp"
+#include "clock_exporter.hpp"
 
 using namespace std;
 //
@@ -44,96 +53,347 @@ class clock_server : public std::enable_shared_from_this<clock_server>{
         // Declare multicast address
         const string multicast_address {"238.10.50.50"};
 
-        // Declare clock id 
-        uint32_t clock_id;
+        // Declare the hosted clock ids and the time stamp of the last broadcast of each (read by the collectors;
+        // the statistics processor keeps the round of every broadcast)
+        vector<uint32_t> clock_ids;
+        vector<atomic<uint64_t>> last_broadcast_ts;
 
         // Declare broadcasting period 
         uint32_t interval;
 
+        // Declare the broadcasting and statistics periods (milliseconds, seconds)
+        uint32_t interval_ms;
+        uint32_t statistics_period {60};
+
+        // Declare the reply window of the broadcasts (microseconds over which clients spread their replies,
+        // 0 to reply at once) and a statistics period deferred past a reply window
+        uint32_t reply_window_us {0};
+        bool statistics_pending {false};
+
+        // Declare the receive buffer charge of a reply datagram (bytes; the kernel charges the whole buffer
+        // of a datagram, not its payload) and the longest pause of a reply drain to absorb (microseconds)
+        enum { reply_truesize = 768, drain_pause_us = 20000 };
+
+        // Declare the receive buffer size requested for every reply socket (bytes, first the kernel default)
+        int rcvbuf_size {0};
+
+        // Declare the local interface of the multicasts (default interface if empty)
+        string interface_address;
+
         // Declare message count
-        uint64_t message_count {0};
+        atomic<uint64_t> message_count {0};
 
-	// Declare the broadcast timer  
-	shared_ptr<clock_timer> oBroadcastTimer;
+        // Declare the long-lived multicast socket (sends broadcasts and receives replies)
+        int sd {-1};
 
-	// Declare the statistics timer  
-	shared_ptr<clock_timer> oStatisticsTimer;
+        // Declare the multicast group address
+        struct sockaddr_in groupSock;
+
+        // Declare the event loop driving the broadcast and statistics timers and reply reads
+        clock_reactor reactor;
+
+        // Declare the broadcast timer
+        int broadcast_timer {-1};
 
         // Declare Outbound Buffer for broadcast messages 
         enum { max_length = 256 };
         char data_[max_length];
 
-        // Declare Inbound Buffer for client responses 
-        enum { max_length_recv = 4096 };
-        char recv_buffer_[max_length_recv];
+        // Declare the wire format of the broadcasts (legacy frames for old clients)
+        ClockWireFormat wire_format {WIRE_CURRENT};
+
+        // Declare the integrity function of the broadcasts
+        ClockCheckSumKind checksum_kind {CHECKSUM_CRC32C};
+
+        // Declare the length of the inbound buffers (one per datagram of a receive batch) and of a batch
+        enum { max_length_recv = 256 };
+        uint32_t batch_size;
+
+        // Declare the length of the ancillary buffer of a datagram, carrying its kernel receive time
+        // stamp (and the count of datagrams the kernel dropped on the socket)
+        const size_t control_length {CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t))};
+
+        // Declare a reply collector: a reply socket drained in batches (inbound buffers, batch headers
+        // and ancillary buffers), the difference of the time source and the realtime kernel time stamps
+        // of its last batch, the kernel drop count of its socket, the replies it received since the last
+        // broadcast round and the load it received in the statistics period: replies received and valid,
+        // and the reply latency (receive time minus broadcast time, microseconds), kept under its mutex
+        struct clock_collector
+        {
+               int sd {-1};
+               uint32_t index {0};
+               thread worker;
+               vector<char> recv_buffer;
+               vector<struct mmsghdr> recv_msgs;
+               vector<struct iovec> recv_iovecs;
+               vector<char> recv_control;
+               int64_t realtime_difference {0};
+               atomic<uint32_t> kernel_drops {0};
+               atomic<uint64_t> round_replies {0};
+               mutex mx;
+               uint64_t period_replies {0};
+               uint64_t period_valid {0};
+               clock_sketch period_latency;
+        };
+
+        // Declare the reply collectors: the first one drains the broadcast socket on the event loop,
+        // unless there are several, each draining its SO_REUSEPORT socket on its own pinned thread
+        vector<unique_ptr<clock_collector>> collectors;
+        atomic<bool> collecting {true};
+
+        // Declare whether the replies reach the collector of their client id (else spread by address hash)
+        bool steered {false};
 
         // Declare the statistics processor
         clock_stats stats;
 
+        // Declare the broadcasts of the statistics period
+        uint64_t period_broadcasts {0};
+
+        // Declare the metrics endpoint and the periodic metrics file (with its period in seconds)
+        clock_exporter exporter {reactor};
+        string metrics_file;
+        uint32_t metrics_period {10};
+
 public:
 
         // Constructor
-        clock_server (uint32_t pClockid, uint32_t piInterval) : 
+        clock_server (vector<uint32_t> const & pClockIDs, uint32_t piInterval, uint32_t piBatchSize, bool pStreaming, int piFsyncInterval, string const & psOutput = "./clock_server.out", uint32_t piCollectors = 1) : 
 
-                      clock_id         (pClockid), 
+                      clock_ids        (pClockIDs), 
+                      last_broadcast_ts(pClockIDs.size()),
                       interval         (piInterval), 
-                      message_count    (0),
-                      oBroadcastTimer  (make_shared<clock_timer>()), 
-                      oStatisticsTimer (make_shared<clock_timer>()) 
+                      interval_ms      (piInterval * 1000),
+                      batch_size       (max(piBatchSize, 1u)),
+                      stats            (pStreaming, piFsyncInterval, psOutput)
         {
+             for (size_t i=0; i<pClockIDs.size(); i++)
+             {
+                  last_broadcast_ts[i].store(0, memory_order_relaxed);
+             }
+             stats.SetBroadcastClocks(pClockIDs.size());
+
+             // Declare the collectors, pointing every batch slot to its own data and ancillary buffers
+             for (uint32_t c=0; c<max(piCollectors, 1u); c++)
+             {
+                  collectors.emplace_back(new clock_collector());
+                  clock_collector & collector = *collectors.back();
+
+                  collector.index = c;
+                  collector.recv_buffer.resize(batch_size * max_length_recv);
+                  collector.recv_msgs.resize(batch_size);
+                  collector.recv_iovecs.resize(batch_size);
+                  collector.recv_control.resize(batch_size * control_length);
+
+                  for (uint32_t i=0; i<batch_size; i++)
+                  {
+                       collector.recv_iovecs[i].iov_base = &collector.recv_buffer[i * max_length_recv];
+                       collector.recv_iovecs[i].iov_len  = max_length_recv;
+
+                       memset(&collector.recv_msgs[i], 0, sizeof(struct mmsghdr));
+                       collector.recv_msgs[i].msg_hdr.msg_iov     = &collector.recv_iovecs[i];
+                       collector.recv_msgs[i].msg_hdr.msg_iovlen  = 1;
+                       collector.recv_msgs[i].msg_hdr.msg_control = &collector.recv_control[i * control_length];
+                  }
+             }
         } 
 
         // Destructor
         ~clock_server() 
         {
-             // Stop the broadcast timer
-             if (oBroadcastTimer->is_running()) 
+             // Stop the collector threads (shutting their sockets down wakes up their receives)
+             collecting = false;
+             for (auto & collector : collectors)
+             {
+                  if (collector->worker.joinable())
+                  {
+                      shutdown(collector->sd, SHUT_RD);
+                      collector->worker.join();
+                  }
+             }
+
+             // Release the descriptors back to the OS (the first collector uses the broadcast socket)
+             for (size_t c=1; c<collectors.size(); c++)
              {
-	         oBroadcastTimer->stop();
+                  if (collectors[c]->sd > -1)
+                  {
+                      close(collectors[c]->sd);
+                  }
              }
 
-             // Stop the statistics timer
-             if (oStatisticsTimer->is_running()) 
+             if (sd > -1)
              {
-	         oStatisticsTimer->stop();
+                 close(sd);
              }
         }
 
+        // Select the integrity function of the broadcasts (clients reply with the same one)
+        void SetCheckSumKind (ClockCheckSumKind pKind)
+        {
+             checksum_kind = pKind;
+        }
+
+        // Discard samples whose round-trip delay exceeds the client's recent minimum by more than the tolerance
+        void SetDelayFilter (uint32_t piWindow, int64_t piTolerance)
+        {
+             stats.SetDelayFilter(piWindow, piTolerance);
+        }
+
+        // Append alert records of spikes, step changes, reply count drops and silent clients to a file
+        void SetAnomalyDetector (string const & psFileName, double pThreshold)
+        {
+             stats.SetAnomalyDetector(psFileName, pThreshold);
+        }
+
+        // Forget the clients silent for piIdle seconds (0 keeps them all)
+        void SetClientExpiry (uint32_t piIdle)
+        {
+             stats.SetClientExpiry(piIdle);
+        }
+
+        // Estimate the drift of every client (offset, ppm, jitter) over samples weighted by a half-life in seconds
+        void SetDriftEstimator (uint32_t piHalfLife)
+        {
+             stats.SetDriftEstimator(piHalfLife);
+        }
+
+        // Ask the clients to spread their replies over piWindow milliseconds after every broadcast (at most half
+        // the broadcast interval); the reply sockets are then sized for the replies arriving in a drain pause
+        void SetReplyWindow (uint32_t piWindow)
+        {
+             reply_window_us = piWindow * 1000;
+        }
+
+        // Broadcast every piInterval milliseconds (overrides the interval in seconds)
+        void SetBroadcastPeriod (uint32_t piInterval)
+        {
+             interval_ms = max(piInterval, 1u);
+        }
+
+        // Record the statistics every piPeriod seconds (default every minute)
+        void SetStatisticsPeriod (uint32_t piPeriod)
+        {
+             statistics_period = max(piPeriod, 1u);
+        }
+
+        // Send the multicasts from the local interface with address psAddress (e.g. 127.0.0.1 for loopback only)
+        void SetInterface (string const & psAddress)
+        {
+             interface_address = psAddress;
+        }
+
+        // Serve the metrics on a local TCP port ("port" or "addr:port") or a Unix socket path
+        void SetMetricsEndpoint (string const & psEndpoint)
+        {
+             exporter.Listen(psEndpoint);
+        }
+
+        // Dump the metrics to a file every piPeriod seconds
+        void SetMetricsFile (string const & psFileName, uint32_t piPeriod)
+        {
+             metrics_file   = psFileName;
+             metrics_period = max(piPeriod, 1u);
+        }
+
+        // Broadcast in the given wire format (replies are decoded in either format)
+        void SetWireFormat (ClockWireFormat pFormat)
+        {
+             wire_format = pFormat;
+        }
+
+        // Also persist the statistics periods to binary log segments <prefix>.NNNNNN.bin
+        void SetBinaryLog (string const & psPrefix, uint64_t piSegmentRecords)
+        {
+             stats.SetBinaryLog(psPrefix, piSegmentRecords);
+        }
+
         // Start broadcasting and receiving reply messages
         void StartBroadcasting ()
         {
-             // Start stats timer (every minute)
-             oStatisticsTimer->start(60*1000, bind(&clock_server::ProcessStatistics, this));
+             // Keep the reply window within half the broadcast interval (replies of a round before the next one)
+             if (reply_window_us > interval_ms * 500)
+             {
+                 reply_window_us = interval_ms * 500;
+                 cerr << "Reply window limited to half the broadcast interval [" << reply_window_us / 1000 << "] ms" << endl;
+             }
 
-             // Start broadcast timer (every interval seconds)
-             oBroadcastTimer->start(interval*1000, bind(&clock_server::StartBroadcasting_impl, this));
+             // Open the multicast socket (and the other reply sockets) once for the lifetime of the server
+             SetupSocket();
 
-             // Run the service by resting the master thread
-             this_thread::sleep_for(chrono::hours(max_length_recv));
+             // Collect client replies whenever the socket becomes readable, or on the collector threads
+             if (collectors.size() == 1)
+             {
+                 reactor.AddReader(sd, bind(&clock_server::ReceiveReady, this, ref(*collectors[0])));
+             }
+             else
+             {
+                 for (auto & collector : collectors)
+                 {
+                      collector->worker = thread(&clock_server::CollectorLoop, this, ref(*collector));
+                      PinThread(collector->worker, collector->index);
+                 }
+             }
+
+             // Start stats timer (every minute unless set otherwise)
+             reactor.AddTimer(statistics_period*1000, bind(&clock_server::StatisticsTimer, this));
+
+             // Start broadcast timer (every interval)
+             broadcast_timer = reactor.AddTimer(interval_ms, bind(&clock_server::StartBroadcasting_impl, this));
+
+             // Start metrics file timer (if requested)
+             if (!metrics_file.empty())
+             {
+                 reactor.AddTimer(metrics_period*1000, bind(&clock_exporter::Dump, metrics_file));
+             }
+
+             // Run the event loop on the master thread
+             reactor.Run();
         }
 
 private:
 
-       // Event handler for Broadcast timer that performs the multicast
+       // Event handler for Broadcast timer that performs the multicast (one per hosted clock)
        void StartBroadcasting_impl  ()
        {
-             // Build a broadcast message
-             ClockSyncMessage oBroadcastMessage = BuildBroadcastMessage();
+             // Record a statistics period deferred past the reply window of the last round (the window is over)
+             if (statistics_pending)
+             {
+                 statistics_pending = false;
+                 ProcessStatistics();
+             }
 
-             // Indicate message has been built
-             PrintSyncMessage("BUILT",oBroadcastMessage);
+             // Size the reply sockets for the replies of the last round spread over the reply window
+             if (reply_window_us > 0)
+             {
+                 uint64_t round_replies {0};
+                 for (auto & collector : collectors)
+                 {
+                      round_replies += collector->round_replies.exchange(0, memory_order_relaxed);
+                 }
+                 SizeReceiveBuffers(round_replies);
+             }
+
+             for (size_t i=0; i<clock_ids.size(); i++)
+             {
+                  // Build a broadcast message of the next round (replies to earlier rounds are late from now on)
+                  ClockSyncMessage oBroadcastMessage = BuildBroadcastMessage(clock_ids[i], stats.GetRound(i) + 1);
+                  last_broadcast_ts[i].store(oBroadcastMessage.server_ts, memory_order_relaxed);
+                  stats.SetRound(i, oBroadcastMessage.sequence, oBroadcastMessage.server_ts);
 
-             // Multicast the message
-             BroadcastMessage(oBroadcastMessage);
+                  // Multicast the message
+                  BroadcastMessage(oBroadcastMessage);
+
+                  // Indicate message has been built (with the checksum of its frame)
+                  TraceSyncMessage(TRACE_BROADCAST, TRACE_BUILT, 0, oBroadcastMessage);
+                  period_broadcasts++;
+             }
        }
 
-       // Perform the multicast of a built sync message
-       void BroadcastMessage(ClockSyncMessage &oBroadcastMessage) 
+       // Open and configure the multicast socket used for broadcasts and replies
+       void SetupSocket()
        {
-             // Declare multigroup socket
+             // Declare local interface
              struct in_addr localInterface;
-             struct sockaddr_in groupSock;
-             int sd;
 
              // Create a datagram socket on which to send 
              sd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
@@ -149,8 +409,8 @@ private:
              groupSock.sin_addr.s_addr = inet_addr(multicast_address.c_str());
              groupSock.sin_port = htons(multicast_port);
 
-             // Set local interface for outbound multicast datagrams 
-             localInterface.s_addr = inet_addr(multicast_address.c_str());
+             // Set local interface for outbound multicast datagrams (default interface unless given)
+             localInterface.s_addr = interface_address.empty() ? htonl(INADDR_ANY) : inet_addr(interface_address.c_str());
              if (setsockopt(sd, IPPROTO_IP, IP_MULTICAST_IF, (char *)&localInterface, sizeof(localInterface)) < 0)
              {
                  cerr << "Error setsockop Setting local interface";
@@ -183,97 +443,528 @@ private:
                 exit (EXIT_FAILURE);
             }
 
-            // Send the sync message to the multicast group 
-            size_t datalen = sizeof(ClockSyncMessage);
-            char* data_= reinterpret_cast<char*>(&oBroadcastMessage);
+            // Set the reply options of the broadcast socket
+            SetupReplySocket(sd);
+            collectors[0]->sd = sd;
+
+            // Several collectors share the reply port: bind the broadcast socket (the port replies
+            // are sent to) and one more socket per collector to it with SO_REUSEPORT
+            if (collectors.size() > 1)
+            {
+                struct sockaddr_in local;
+                socklen_t local_length = sizeof(local);
+                memset(&local, 0, sizeof(local));
+                local.sin_family      = AF_INET;
+                local.sin_addr.s_addr = htonl(INADDR_ANY);
+                local.sin_port        = 0;
+
+                int reuse_port = 1;
+                if (setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &reuse_port, sizeof(reuse_port)) < 0 ||
+                    bind(sd, (struct sockaddr*)&local, sizeof(local)) < 0 ||
+                    getsockname(sd, (struct sockaddr*)&local, &local_length) < 0)
+                {
+                    cerr << "Error binding the reply port";
+                    exit(EXIT_FAILURE);
+                }
+
+                for (size_t c=1; c<collectors.size(); c++)
+                {
+                     int reply_sd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+                     if (reply_sd < 0 ||
+                         setsockopt(reply_sd, SOL_SOCKET, SO_REUSEPORT, &reuse_port, sizeof(reuse_port)) < 0 ||
+                         bind(reply_sd, (struct sockaddr*)&local, sizeof(local)) < 0)
+                     {
+                         cerr << "Error binding reply socket [" << c << "] to the reply port";
+                         exit(EXIT_FAILURE);
+                     }
+
+                     SetupReplySocket(reply_sd);
+                     collectors[c]->sd = reply_sd;
+                }
+
+                // Steer the replies by client id (sockets of the group are indexed in bind order), so
+                // each client is only ever seen by one collector
+                steered = AttachSteering();
+            }
+
+            // Reply sockets start with the kernel default receive buffer (reported doubled), only grown for the reply window
+            rcvbuf_size = GetReceiveBufferSize() / 2;
+       }
+
+       // Size the receive buffers of the reply sockets from the reply window: the replies of a round arrive
+       // spread over the window, so a socket only holds those arriving in the longest pause of its drain
+       // (shared among the collectors). Buffers only grow, with a quarter of headroom; the kernel doubles
+       // the size requested for its own overhead
+       void SizeReceiveBuffers (uint64_t piRoundReplies)
+       {
+            uint64_t burst = min<uint64_t>(piRoundReplies, (piRoundReplies * drain_pause_us + reply_window_us - 1) / reply_window_us);
+            uint64_t needed = (burst + collectors.size() - 1) / collectors.size() * reply_truesize;
+            if (needed <= static_cast<uint64_t>(rcvbuf_size))
+            {
+                return;
+            }
+
+            int size = static_cast<int>(min<uint64_t>(needed + needed / 4, INT_MAX / 2));
+            for (auto & collector : collectors)
+            {
+                 // Beyond the system limit (net.core.rmem_max) with the privilege, else up to it
+                 if (setsockopt(collector->sd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0 &&
+                     setsockopt(collector->sd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0)
+                 {
+                     cerr << "Error setsockopt receive buffer size [" << size << "]\n";
+                 }
+            }
+
+            rcvbuf_size = size;
+       }
+
+       // Get the receive buffer size of the reply sockets as set by the kernel (bytes)
+       int GetReceiveBufferSize () const
+       {
+            int size {0};
+            socklen_t length = sizeof(size);
+            return getsockopt(sd, SOL_SOCKET, SO_RCVBUF, &size, &length) < 0 ? 0 : size;
+       }
+
+       // Set the options of a socket receiving replies
+       void SetupReplySocket(int reply_sd)
+       {
+            // Set option for kernel receive time stamps (nanoseconds) on every reply
+            int timestamp_ns = 1;
+            if (setsockopt(reply_sd, SOL_SOCKET, SO_TIMESTAMPNS, &timestamp_ns, sizeof(timestamp_ns)) < 0)
+            {
+                cerr << "Error setsockopt receive time stamps";
+                exit (EXIT_FAILURE);
+            }
+
+            // Set option for the count of replies dropped by the kernel (full receive buffer)
+            int rxq_ovfl = 1;
+            if (setsockopt(reply_sd, SOL_SOCKET, SO_RXQ_OVFL, &rxq_ovfl, sizeof(rxq_ovfl)) < 0)
+            {
+                cerr << "Error setsockopt receive queue overflow count";
+            }
+       }
+
+       // Attach a classic BPF program to the reply port selecting the socket of a reply by its client
+       // id (little-endian at offset 12 of versioned frames, 0 of legacy frames) modulo the collectors
+       // (false if it could not be attached)
+       bool AttachSteering()
+       {
+#if defined SO_ATTACH_REUSEPORT_CBPF
+            vector<struct sock_filter> code;
+
+            // Versioned frames start with the magic ("CK"), legacy frames with the client id
+            code.push_back(BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 0));
+            code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (clock_wire_magic & 0xff) << 8 | clock_wire_magic >> 8, 0, 0));
+
+            // Assemble the little-endian client id at an offset, then select its collector (legacy
+            // frames jump over the versioned frame code)
+            for (uint32_t offset : {12u, 0u})
+            {
+                 if (offset == 0)
+                 {
+                     code[1].jf = code.size() - 2;
+                 }
+
+                 code.push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offset + 3));
+                 code.push_back(BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 24));
+                 code.push_back(BPF_STMT(BPF_MISC | BPF_TAX, 0));
+                 for (uint32_t byte : {2u, 1u, 0u})
+                 {
+                      code.push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offset + byte));
+                      if (byte > 0)
+                      {
+                          code.push_back(BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, byte * 8));
+                      }
+                      code.push_back(BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0));
+                      if (byte > 0)
+                      {
+                          code.push_back(BPF_STMT(BPF_MISC | BPF_TAX, 0));
+                      }
+                 }
+                 code.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, static_cast<uint32_t>(collectors.size())));
+                 code.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+            }
+
+            struct sock_fprog program;
+            program.len    = code.size();
+            program.filter = code.data();
+            if (setsockopt(sd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) < 0)
+            {
+                cerr << "Error attaching the reply steering program (replies are spread by address hash)\n";
+                return false;
+            }
+
+            return true;
+#else
+            cerr << "Reply steering is not supported on this system (replies are spread by address hash)\n";
+            return false;
+#endif
+       }
+
+       // Pin a collector thread to one of the processors the process may run on (round robin)
+       static void PinThread(thread & poThread, uint32_t piIndex)
+       {
+            cpu_set_t allowed;
+            CPU_ZERO(&allowed);
+            if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0 || CPU_COUNT(&allowed) == 0)
+            {
+                return;
+            }
+
+            uint32_t target = piIndex % CPU_COUNT(&allowed);
+            for (int cpu=0; cpu<CPU_SETSIZE; cpu++)
+            {
+                 if (CPU_ISSET(cpu, &allowed) && target-- == 0)
+                 {
+                     cpu_set_t pinned;
+                     CPU_ZERO(&pinned);
+                     CPU_SET(cpu, &pinned);
+                     if (pthread_setaffinity_np(poThread.native_handle(), sizeof(pinned), &pinned) != 0)
+                     {
+                         cerr << "Error pinning collector [" << piIndex << "] to processor [" << cpu << "]\n";
+                     }
+                     return;
+                 }
+            }
+       }
+
+       // Perform the multicast of a built sync message
+       void BroadcastMessage(ClockSyncMessage &oBroadcastMessage) 
+       {
+            clock_metrics_scope timing (LATENCY_BROADCAST);
+
+            // Encode and send the sync message to the multicast group 
+            size_t datalen = EncodeSyncMessage(oBroadcastMessage, data_, max_length, wire_format);
             if (sendto(sd, data_, datalen, 0, (struct sockaddr*)&groupSock, sizeof(groupSock)) < 0)
             {
                 cerr << "Error Sending datagram message in multicast";
+                clock_metrics::Add(METRIC_BROADCAST_ERRORS);
+                return;
             }
 
-            // Set a non-blocking recv time out if there is no data incoming
-            struct timeval read_timeout;
-            read_timeout.tv_sec = 0;
-            read_timeout.tv_usec = 50000;
-            if (setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &read_timeout, sizeof read_timeout))
+            clock_metrics::Add(METRIC_BROADCASTS);
+       }
+
+       // Read handler draining all pending replies from multiple clients in batches (edge-triggered)
+       void ReceiveReady(clock_collector & poCollector)
+       {
+            while (true)
             {
-                cerr << "Error setsockopt recv timeout";
-                exit(EXIT_FAILURE);
+                 // Receiving a batch of messages back from multiple clients
+                 int msgs_recv = ReceiveBatch(poCollector, MSG_DONTWAIT);
+                 if (msgs_recv < 0 && errno == EINTR)
+                 {
+                     continue;
+                 }
+
+                 // Stop when the socket is empty
+                 if (msgs_recv <= 0)
+                 {
+                     break;
+                 }
+
+                 ProcessBatch(poCollector, msgs_recv);
+
+                 // A partial batch means the socket has been drained
+                 if (static_cast<uint32_t>(msgs_recv) < batch_size)
+                 {
+                     break;
+                 }
             }
+       }
 
-            // Receiving messages back from multiple clients
-            size_t bytes_recv {0};
-            while ((bytes_recv = recvfrom(sd, &recv_buffer_, datalen, 0, NULL, NULL)) > 0 && bytes_recv == datalen) 
+       // Collector thread draining its reply socket in batches (blocking until a reply arrives)
+       void CollectorLoop(clock_collector & poCollector)
+       {
+            // Keep the points of this collector in a statistics shard of its own when it sees all the
+            // replies of its clients (else a client hashes to the shard of its state)
+            if (steered)
             {
-                // Process Received unicast message from client
-                ReceiveHandler (bytes_recv);
+                clock_stats::BindShard(poCollector.index);
             }
 
-            // Release the descriptor back to the OS
-            close(sd);
+            while (collecting)
+            {
+                 int msgs_recv = ReceiveBatch(poCollector, MSG_WAITFORONE);
+                 if (msgs_recv < 0 && errno == EINTR)
+                 {
+                     continue;
+                 }
+
+                 if (msgs_recv <= 0 || !collecting)
+                 {
+                     break;
+                 }
+
+                 ProcessBatch(poCollector, msgs_recv);
+            }
        }
 
-       // Receive Handler of incoming reply messages
-       void ReceiveHandler (size_t bytes_recvd)
+       // Receive a batch of replies on the socket of a collector
+       int ReceiveBatch(clock_collector & poCollector, int piFlags)
+       {
+            // Reset the ancillary buffer lengths (updated by the kernel on every receive)
+            for (uint32_t i=0; i<batch_size; i++)
+            {
+                 poCollector.recv_msgs[i].msg_hdr.msg_controllen = control_length;
+            }
+
+            return recvmmsg(poCollector.sd, poCollector.recv_msgs.data(), batch_size, piFlags, NULL);
+       }
+
+       // Process a received batch of replies of a collector
+       void ProcessBatch(clock_collector & poCollector, int piReceived)
+       {
+            lock_guard<mutex> lock(poCollector.mx);
+
+            // Difference of the time source and the realtime clock of the kernel time stamps
+            poCollector.realtime_difference = clock_time_source::GetTimeSource().GetRealtimeDifference();
+
+            for (int i=0; i<piReceived; i++)
+            {
+                 // Process the unicast messages from clients (frames are checked while decoding)
+                 ReceiveHandler (poCollector, &poCollector.recv_buffer[i * max_length_recv], poCollector.recv_msgs[i].msg_len,
+                                 GetReceiveTimeStamp(poCollector, poCollector.recv_msgs[i].msg_hdr));
+            }
+
+            // Account the batch (the kernel drop count is cumulative, the last datagram has the latest)
+            poCollector.round_replies.fetch_add(piReceived, memory_order_relaxed);
+            clock_metrics::Add(METRIC_PACKETS_RECEIVED, piReceived);
+            UpdateKernelDrops(poCollector, poCollector.recv_msgs[piReceived - 1].msg_hdr);
+       }
+
+       // Get the kernel receive time stamp (in nanoseconds, moved to the time source) of a datagram
+       // (or the current time if missing)
+       uint64_t GetReceiveTimeStamp (clock_collector & poCollector, struct msghdr & poHeader)
+       {
+            for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&poHeader); cmsg != NULL; cmsg = CMSG_NXTHDR(&poHeader, cmsg))
+            {
+                 if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+                 {
+                     struct timespec ts;
+                     memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                     return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec + poCollector.realtime_difference;
+                 }
+            }
+
+            return GetCurrentTime_ns();
+       }
+
+       // Publish the number of datagrams dropped by the kernel on the reply sockets (if reported)
+       void UpdateKernelDrops (clock_collector & poCollector, struct msghdr & poHeader)
        {
-            // Lock while processing sync message 
-            mutex omutex;
-            lock_guard<mutex> lock(omutex);
+            for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&poHeader); cmsg != NULL; cmsg = CMSG_NXTHDR(&poHeader, cmsg))
+            {
+                 if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+                 {
+                     uint32_t drops;
+                     memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+                     poCollector.kernel_drops.store(drops, memory_order_relaxed);
 
-            // Get the immediate (client) time stamp when server message is received
-            uint64_t FinalTimeStamp = GetCurrentTimeSinceEpoch();
+                     int64_t total_drops {0};
+                     for (auto & collector : collectors)
+                     {
+                          total_drops += collector->kernel_drops.load(memory_order_relaxed);
+                     }
+                     clock_metrics::Set(METRIC_KERNEL_DROPS, total_drops);
+                 }
+            }
+       }
+
+       // Receive Handler of incoming reply messages
+       void ReceiveHandler (clock_collector & poCollector, const char* pBuffer, size_t pLength, uint64_t FinalTimeStamp)
+       {
+            clock_metrics_scope timing (LATENCY_RECEIVE, true);
+            poCollector.period_replies++;
 
-            // Get a pointer to the received sync message
-            ClockSyncMessage* oReceivedMessage = reinterpret_cast<ClockSyncMessage*>(recv_buffer_);
+            // Decode the received frame (truncated, foreign or unknown frames are dropped)
+            ClockSyncMessage oReceivedMessage;
+            if (!DecodeSyncMessage(pBuffer, pLength, oReceivedMessage))
+            {
+                clock_metrics::Add(METRIC_SIZE_MISMATCHES);
+                return;
+            }
                   
             // Validate the message before processing (in case of mangling per packet drops)
-            if (ValidateCheckSum (*oReceivedMessage))
+            if (!ValidateCheckSum (oReceivedMessage))
             {
-                // Process the (client-time-stamped) received message
-                ProcessReceivedMessage (*oReceivedMessage, FinalTimeStamp);
+                clock_metrics::Add(METRIC_CHECKSUM_FAILURES);
+            }
+            else
+            {
+                // Process the (kernel-time-stamped) received message
+                ProcessReceivedMessage (poCollector, oReceivedMessage, FinalTimeStamp);
             }
-
-            // Clear the reception buffer
-            memset (recv_buffer_,0,max_length_recv);
        }
 
        // Process received Sync message from clients
-       void ProcessReceivedMessage (ClockSyncMessage const & poReceivedMsg, uint64_t pFinalTimeStamp)
+       void ProcessReceivedMessage (clock_collector & poCollector, ClockSyncMessage const & poReceivedMsg, uint64_t pFinalTimeStamp)
        {
+            // Attribute the reply to a hosted clock (replies to other servers' clocks are dropped)
+            int clock_index = FindClock(poReceivedMsg);
+            if (clock_index < 0)
+            {
+                clock_metrics::Add(METRIC_UNKNOWN_CLOCKS);
+                return;
+            }
+
             // Print message received from client
-            PrintSyncMessage("PROCD("+to_string(++message_count)+")",poReceivedMsg);
+            TraceSyncMessage(TRACE_MESSAGES, TRACE_PROCD, ++message_count, poReceivedMsg);
+
+            // Compute the offset and the round-trip delay from the four time stamps (nanoseconds, rounded once)
+            int64_t offset_us = RoundToMicroseconds (ComputeOffset (poReceivedMsg, pFinalTimeStamp));
+            int64_t delay_us  = RoundToMicroseconds (ComputeDelay (poReceivedMsg, pFinalTimeStamp));
 
-            // Compute the offset
-            int64_t offset_us = (pFinalTimeStamp + poReceivedMsg.server_ts)/2 - poReceivedMsg.client_ts;
+            // Add offset for this client of the clock to the stats processor (unless its delay is filtered out, or it
+            // is a duplicate reply, or a reply received once the next round went out); a single hosted clock keeps the
+            // statistics without the server clock column
+            stats.AddPoint (clock_ids.size() > 1 ? clock_ids[clock_index] : 0, poReceivedMsg.clock_id, offset_us, delay_us, pFinalTimeStamp,
+                            poReceivedMsg.sequence, clock_index);
 
-            // Add offset for this client to the stats processor
-            stats.AddPoint (poReceivedMsg.clock_id, offset_us);
+            // Account the reply in the load of the period
+            poCollector.period_valid++;
+            poCollector.period_latency.Add(RoundToMicroseconds(static_cast<int64_t>(pFinalTimeStamp - poReceivedMsg.server_ts)));
        }
  
-       // Build Sync Message to be broadcast
-       ClockSyncMessage BuildBroadcastMessage (void) 
+       // Find the hosted clock a reply answers (-1 if none)
+       int FindClock (ClockSyncMessage const & poReceivedMsg) const
+       {
+            // Replies of current clients carry the server clock
+            if (poReceivedMsg.server_id != 0)
+            {
+                auto it = find(clock_ids.begin(), clock_ids.end(), poReceivedMsg.server_id);
+                return it != clock_ids.end() ? static_cast<int>(it - clock_ids.begin()) : -1;
+            }
+
+            // Replies of legacy clients do not: a single hosted clock takes them all, otherwise
+            // the echoed broadcast time (in microseconds, as legacy frames carry it) tells the clock
+            if (clock_ids.size() == 1)
+            {
+                return 0;
+            }
+
+            for (size_t i=0; i<clock_ids.size(); i++)
+            {
+                 if (last_broadcast_ts[i].load(memory_order_relaxed) / 1000 == poReceivedMsg.server_ts / 1000)
+                 {
+                     return static_cast<int>(i);
+                 }
+            }
+
+            return -1;
+       }
+ 
+       // Build Sync Message of a round of a hosted clock to be broadcast
+       ClockSyncMessage BuildBroadcastMessage (uint32_t pClockID, uint32_t pSequence) 
        {
            // Declare response message
            ClockSyncMessage oBroadcastMsg;
 
            // Set up the broadcast message
-           oBroadcastMsg.clock_id  = clock_id;
-           oBroadcastMsg.server_ts = GetCurrentTimeSinceEpoch();
+           oBroadcastMsg.clock_id  = pClockID;
+           oBroadcastMsg.server_ts = GetCurrentTime_ns();
            oBroadcastMsg.client_ts = 0;
-           oBroadcastMsg.checksum  = ComputeCheckSum(oBroadcastMsg);
+           oBroadcastMsg.client_tx_ts = 0;
+           oBroadcastMsg.reply_window = reply_window_us;
+           oBroadcastMsg.sequence  = pSequence;
+           oBroadcastMsg.checksum_kind = checksum_kind;
 
            // return built message 
            return oBroadcastMsg;
        }
 
+       // Event handler for the statistics timer: a period ending inside the reply window of a round (of
+       // the latest broadcast of the hosted clocks) is recorded at the next broadcast instead, leaving the
+       // event loop to the replies of the window
+       void StatisticsTimer()
+       {
+            uint64_t latest {0};
+            for (auto & broadcast_ts : last_broadcast_ts)
+            {
+                 latest = max<uint64_t>(latest, broadcast_ts.load(memory_order_relaxed));
+            }
+
+            if (reply_window_us > 0 && GetCurrentTime_ns() < latest + (reply_window_us + drain_pause_us) * 1000ULL)
+            {
+                statistics_pending = true;
+                return;
+            }
+
+            ProcessStatistics();
+       }
+
        // Event handler for printing statistics periodically
        void ProcessStatistics() 
        {
             // Indicate a new statistics period
-            cerr << "\nSTAT: Persisting Statistcs for this last minute ... \n";
+            cerr << "\nSTAT: Persisting Statistcs for this last " << (statistics_period == 60 ? string("minute") : to_string(statistics_period) + " seconds") << " ... \n";
+            cerr << "STAT: Broadcast timer " << FormatLateness(reactor.GetLateness(broadcast_timer)) << "\n";
+
+            // Take the load of the period from every collector
+            uint64_t period_replies {0}, period_valid {0};
+            clock_sketch period_latency;
+            for (auto & collector : collectors)
+            {
+                 lock_guard<mutex> lock(collector->mx);
+                 period_replies += collector->period_replies;
+                 period_valid   += collector->period_valid;
+                 period_latency.Merge(collector->period_latency);
+
+                 collector->period_replies = collector->period_valid = 0;
+                 collector->period_latency.Reset();
+            }
+
+            // Indicate the load of the period
+            cerr << "STAT: Replies valid [" << period_valid << "] received [" << period_replies << "] broadcasts [" << period_broadcasts
+                 << "] latency us p50 [" << period_latency.GetQuantile(0.5) << "] p90 [" << period_latency.GetQuantile(0.9)
+                 << "] p99 [" << period_latency.GetQuantile(0.99) << "] max [" << period_latency.GetMax() << "]\n";
+
+            period_broadcasts = 0;
+
+            // Indicate the reply window and the receive buffers sized for it
+            if (reply_window_us > 0)
+            {
+                cerr << "STAT: Reply window [" << reply_window_us << "] us receive buffer [" << GetReceiveBufferSize() << "] bytes per socket\n";
+            }
 
             // Persist statistics to file
             stats.RecordStatistics();
+
+            // Indicate the samples discarded by the delay filter
+            pair<uint64_t, uint64_t> filter_counts = stats.GetFilterCounts();
+            if (filter_counts.first > 0)
+            {
+                cerr << "STAT: Delay filter rejected [" << filter_counts.second << "] of [" << filter_counts.first << "] samples\n";
+            }
+
+            // Indicate the live fleet of clients (joined and forgotten in the period)
+            ClockClientCounts client_counts = stats.GetClientCounts();
+            cerr << "STAT: Clients active [" << client_counts.active << "] joined [" << client_counts.joined << "] expired [" << client_counts.expired << "]\n";
+
+            // Indicate the replies to the broadcast rounds of the period (replies of legacy clients carry no round)
+            ClockRoundCounts round_counts = stats.GetRoundCounts();
+            if (round_counts.on_time + round_counts.missed + round_counts.late + round_counts.duplicate > 0)
+            {
+                ostringstream loss;
+                loss << fixed << setprecision(2) << (round_counts.on_time + round_counts.missed > 0 ? 100.0 * round_counts.missed / (round_counts.on_time + round_counts.missed) : 0.0);
+                cerr << "STAT: Rounds answered [" << round_counts.on_time << "] missed [" << round_counts.missed << "] loss [" << loss.str()
+                     << "%] late [" << round_counts.late << "] duplicate [" << round_counts.duplicate << "]\n";
+            }
+
+            // Indicate the alerts raised on the period
+            uint64_t alert_count = stats.GetAlertCount();
+            if (alert_count > 0)
+            {
+                cerr << "STAT: Alerts raised [" << alert_count << "]\n";
+            }
+
+            // Indicate the client drifting the most
+            pair<string, ClockDriftEstimate> drift_peak = stats.GetDriftPeak();
+            if (drift_peak.second.valid)
+            {
+                cerr << "STAT: Drift max [" << clock_stats::FormatDrift(drift_peak.second) << "] (offset us, ppm, jitter us) client [" << drift_peak.first << "]\n";
+            }
        }
 };
 
@@ -287,22 +978,126 @@ int main(int argc, char* argv[])
       // Check for the required input parameters
       if (argc < 2)
       {
-          cerr << "\nUsage: clock_server <clock_id> [interval]\n";
+          cerr << "\nUsage: clock_server <clock_id[,clock_id...]> [interval] [--batch <replies per receive>] [--collectors <reply sockets and threads>] [--streaming] [--fsync <-1 never | 0 every period | seconds>] [--binlog <prefix> [--segment-records <n>]] [--trace <0 off | 1 broadcasts | 2 all messages>] [--filter-window <n, 0 off>] [--filter-tolerance <us>] [--drift <half-life secs, 0 off>] [--client-idle <secs, 0 never>] [--alerts <file> [--alert-threshold <robust sigmas>]] [--reply-window <ms>] [--checksum <wordsum | crc32c>] [--wire <legacy | current>] [--legacy-wire] [--time-source <realtime | monotonic-raw | tsc>] [--interval-ms <ms>] [--stats-period <secs>] [--interface <local address>] [--output <statistics file>] [--metrics <port | addr:port | unix socket path>] [--metrics-file <path> [--metrics-period <secs>]]\n";
           return -1;
       }
 
-      // Declare the clock id and optional interval (default 10 seconds)
+      // Declare the hosted clock ids and optional interval (default 10 seconds)
       uint32_t interval {10};
-      uint32_t clock_id = atoi(argv[1]);
+      vector<uint32_t> clock_ids = ParseList(argv[1]);
+
+      // Several hosted clocks must have distinct nonzero ids (replies are told apart by them)
+      vector<uint32_t> sorted_ids (clock_ids);
+      sort(sorted_ids.begin(), sorted_ids.end());
+      if (clock_ids.empty() || (clock_ids.size() > 1 && (sorted_ids[0] == 0 || adjacent_find(sorted_ids.begin(), sorted_ids.end()) != sorted_ids.end())))
+      {
+          cerr << "\nInvalid clock ids [" << argv[1] << "]: several clocks need distinct nonzero ids\n";
+          return -1;
+      }
 
       // Check if the optional interval has been specified
-      if (argc > 2)
+      if (argc > 2 && argv[2][0] != '-')
       {
           interval = atoi(argv[2]);
       }
 
+      // Declare the number of replies read per receive call (default 64)
+      uint32_t batch_size = atoi(GetCommandOption(argc, argv, "--batch", "64").c_str());
+
+      // Check if statistics are to be kept as streaming sketches (adds p90, p99, p99.9 columns)
+      bool streaming = HasCommandOption(argc, argv, "--streaming");
+
+      // Declare the fsync policy of the statistics file (default never)
+      int fsync_interval = atoi(GetCommandOption(argc, argv, "--fsync", "-1").c_str());
+
+      // Set the trace verbosity (default from CLOCK_TRACE, else broadcasts only)
+      string trace_level = GetCommandOption(argc, argv, "--trace");
+      if (!trace_level.empty())
+      {
+          clock_trace::GetTrace().SetLevel(atoi(trace_level.c_str()));
+      }
+
+      // Select the source of the time stamps before any thread reads it (default realtime)
+      if (!SelectTimeSource(GetCommandOption(argc, argv, "--time-source", "realtime")))
+      {
+          return -1;
+      }
+
+      // Declare the number of reply collectors (default one, on the event loop; several are steered by client id)
+      uint32_t collectors = atoi(GetCommandOption(argc, argv, "--collectors", "1").c_str());
+
       // Declare the multicast clock server object
-      clock_server clock (clock_id, interval);
+      clock_server clock (clock_ids, interval, batch_size, streaming, fsync_interval, GetCommandOption(argc, argv, "--output", "./clock_server.out"), collectors);
+
+      // Check if the broadcast period is given in milliseconds
+      string interval_ms = GetCommandOption(argc, argv, "--interval-ms");
+      if (!interval_ms.empty())
+      {
+          clock.SetBroadcastPeriod(atoi(interval_ms.c_str()));
+      }
+
+      // Set the window the clients spread their replies over (default none, replies at once)
+      clock.SetReplyWindow(atoi(GetCommandOption(argc, argv, "--reply-window", "0").c_str()));
+
+      // Set the statistics period (default every minute) and the multicast interface (default any)
+      clock.SetStatisticsPeriod(atoi(GetCommandOption(argc, argv, "--stats-period", "60").c_str()));
+      clock.SetInterface(GetCommandOption(argc, argv, "--interface"));
+
+      // Set the round-trip delay filter (default minimum of the last 8 delays, 200 us tolerance)
+      clock.SetDelayFilter(atoi(GetCommandOption(argc, argv, "--filter-window", "8").c_str()), atoll(GetCommandOption(argc, argv, "--filter-tolerance", "200").c_str()));
+
+      // Check if anomalies are to be detected (default threshold 6 robust standard deviations)
+      string alerts_file = GetCommandOption(argc, argv, "--alerts");
+      if (!alerts_file.empty())
+      {
+          clock.SetAnomalyDetector(alerts_file, atof(GetCommandOption(argc, argv, "--alert-threshold", "6").c_str()));
+      }
+
+      // Forget the clients silent for the idle time (default 10 minutes, 0 never)
+      clock.SetClientExpiry(atoi(GetCommandOption(argc, argv, "--client-idle", "600").c_str()));
+
+      // Set the drift estimator (default off; adds offset,ppm,jitter columns to the statistics lines)
+      clock.SetDriftEstimator(atoi(GetCommandOption(argc, argv, "--drift", "0").c_str()));
+
+      // Set the integrity function of the broadcasts (replies use the same one; default CRC32C)
+      string checksum_name = GetCommandOption(argc, argv, "--checksum", "crc32c");
+      ClockCheckSumKind checksum_kind {CHECKSUM_CRC32C};
+      if (!ParseCheckSumName(checksum_name, checksum_kind))
+      {
+          cerr << "\nUnknown checksum [" << checksum_name << "]: wordsum or crc32c\n";
+          return -1;
+      }
+      clock.SetCheckSumKind(checksum_kind);
+
+      // Check if the metrics are to be served and dumped
+      string metrics_endpoint = GetCommandOption(argc, argv, "--metrics");
+      if (!metrics_endpoint.empty())
+      {
+          clock.SetMetricsEndpoint(metrics_endpoint);
+      }
+
+      string metrics_file = GetCommandOption(argc, argv, "--metrics-file");
+      if (!metrics_file.empty())
+      {
+          clock.SetMetricsFile(metrics_file, atoi(GetCommandOption(argc, argv, "--metrics-period", "10").c_str()));
+      }
+
+      // Set the wire format of the broadcasts (clients of the original release need legacy frames; default the current one)
+      string wire_name = HasCommandOption(argc, argv, "--legacy-wire") ? "legacy" : GetCommandOption(argc, argv, "--wire", GetWireFormatName(WIRE_CURRENT));
+      ClockWireFormat wire_format {WIRE_CURRENT};
+      if (!ParseWireFormatName(wire_name, wire_format))
+      {
+          cerr << "\nUnknown wire format [" << wire_name << "]: legacy or current\n";
+          return -1;
+      }
+      clock.SetWireFormat(wire_format);
+
+      // Check if the statistics are also to be persisted in the binary log format
+      string binlog_prefix = GetCommandOption(argc, argv, "--binlog");
+      if (!binlog_prefix.empty())
+      {
+          clock.SetBinaryLog(binlog_prefix, strtoull(GetCommandOption(argc, argv, "--segment-records", "1000000").c_str(), NULL, 10));
+      }
 
       // Start multicasting from the clock server
       clock.StartBroadcasting ();
@@ -0,0 +1,200 @@
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// Class clock_sketch: Streaming summary of time skews (offsets). Keeps count, min, max and mean
+//                     online plus a mergeable log-linear (HDR style) histogram for quantiles.
+//                     Values below 32 are exact; above, buckets are 1/16 of a power of two wide
+//                     (relative error under 3.2%), and only the span of buckets seen is stored.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_sketch
+{
+        // Declare number of exact values and of sub-buckets per power of two
+        enum { exact_values = 32, sub_buckets = 16, sub_bits = 4, exact_bits = 5 };
+
+        // Declare the online summary
+        uint64_t count {0};
+        int64_t  min_value {0};
+        int64_t  max_value {0};
+        double   sum {0.0};
+
+        // Declare the bucket counts and the (signed) bucket index of the first one
+        vector<uint32_t> buckets;
+        int32_t first_bucket {0};
+
+public:
+
+        // Constructor
+        clock_sketch () {}
+
+        // Add a value to the sketch
+        void Add (int64_t pValue)
+        {
+             // Update the online summary
+             if (count == 0)
+             {
+                 min_value = max_value = pValue;
+             }
+             else
+             {
+                 min_value = min(min_value, pValue);
+                 max_value = max(max_value, pValue);
+             }
+
+             count++;
+             sum += pValue;
+
+             // Count the value in its bucket
+             int32_t index = GetBucketIndex(pValue);
+             Extend(index, index);
+             buckets[index - first_bucket]++;
+        }
+
+        // Merge another sketch into this one
+        void Merge (clock_sketch const & poSketch)
+        {
+             if (poSketch.count == 0)
+             {
+                 return;
+             }
+
+             if (count == 0)
+             {
+                 min_value = poSketch.min_value;
+                 max_value = poSketch.max_value;
+             }
+             else
+             {
+                 min_value = min(min_value, poSketch.min_value);
+                 max_value = max(max_value, poSketch.max_value);
+             }
+
+             count += poSketch.count;
+             sum   += poSketch.sum;
+
+             // Add the bucket counts over the union of both spans
+             Extend(poSketch.first_bucket, poSketch.first_bucket + static_cast<int32_t>(poSketch.buckets.size()) - 1);
+             for (size_t i=0; i<poSketch.buckets.size(); i++)
+             {
+                  buckets[poSketch.first_bucket + i - first_bucket] += poSketch.buckets[i];
+             }
+        }
+
+        // Reset the sketch for the next period (keeping the bucket storage)
+        void Reset ()
+        {
+             count = 0;
+             sum   = 0.0;
+             min_value = max_value = 0;
+             fill(buckets.begin(), buckets.end(), 0);
+        }
+
+        // Get the summary values
+        uint64_t GetCount () const { return count; }
+        int64_t  GetMin ()   const { return min_value; }
+        int64_t  GetMax ()   const { return max_value; }
+        int64_t  GetMean ()  const { return count > 0 ? static_cast<int64_t>(sum / count) : 0; }
+
+        // Get the value at quantile pQ (0..1), within the bucket resolution
+        int64_t GetQuantile (double pQ) const
+        {
+             if (count == 0)
+             {
+                 return 0;
+             }
+
+             // Rank of the requested sample (1 based)
+             uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(ceil(pQ * count)));
+             uint64_t cumulative {0};
+
+             for (size_t i=0; i<buckets.size(); i++)
+             {
+                  cumulative += buckets[i];
+                  if (cumulative >= rank)
+                  {
+                      // Report the bucket midpoint, never outside the observed range
+                      int64_t value = GetBucketValue(first_bucket + static_cast<int32_t>(i));
+                      return min(max(value, min_value), max_value);
+                  }
+             }
+
+             return max_value;
+        }
+
+private:
+
+        // Get the (signed, monotonic) bucket index of a value
+        static int32_t GetBucketIndex (int64_t pValue)
+        {
+             uint64_t magnitude = pValue < 0 ? 0 - static_cast<uint64_t>(pValue) : static_cast<uint64_t>(pValue);
+             int32_t index;
+
+             if (magnitude < exact_values)
+             {
+                 index = static_cast<int32_t>(magnitude);
+             }
+             else
+             {
+                 // Power of two of the value and its top sub_bits below the leading bit
+                 int32_t exponent = 63 - __builtin_clzll(magnitude);
+                 int32_t sub = static_cast<int32_t>((magnitude >> (exponent - sub_bits)) & (sub_buckets - 1));
+                 index = exact_values + (exponent - exact_bits) * sub_buckets + sub;
+             }
+
+             return pValue < 0 ? -index : index;
+        }
+
+        // Get the representative (midpoint) value of a bucket
+        static int64_t GetBucketValue (int32_t pIndex)
+        {
+             int32_t index = pIndex < 0 ? -pIndex : pIndex;
+             int64_t value;
+
+             if (index < exact_values)
+             {
+                 value = index;
+             }
+             else
+             {
+                 int32_t exponent = (index - exact_values) / sub_buckets + exact_bits;
+                 int32_t sub = (index - exact_values) % sub_buckets;
+                 int64_t width = int64_t(1) << (exponent - sub_bits);
+                 value = (sub_buckets + sub) * width + width / 2;
+             }
+
+             return pIndex < 0 ? -value : value;
+        }
+
+        // Extend the stored bucket span to cover [pLow, pHigh]
+        void Extend (int32_t pLow, int32_t pHigh)
+        {
+             if (buckets.empty())
+             {
+                 first_bucket = pLow;
+                 buckets.assign(pHigh - pLow + 1, 0);
+                 return;
+             }
+
+             int32_t last_bucket = first_bucket + static_cast<int32_t>(buckets.size()) - 1;
+
+             if (pLow < first_bucket)
+             {
+                 buckets.insert(buckets.begin(), first_bucket - pLow, 0);
+                 first_bucket = pLow;
+             }
+
+             if (pHigh > last_bucket)
+             {
+                 buckets.resize(buckets.size() + (pHigh - last_bucket), 0);
+             }
+        }
+};
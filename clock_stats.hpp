@@ -1,5 +1,7 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
 #include <iterator>
 #include <vector>
 #include <string>
@@ -10,8 +12,99 @@
 #include <thread>
 #include <mutex>
 #include <numeric>
+#include <memory>
+
+#include "clock_metrics.hpp"
+#include "clock_sketch.hpp"
+#include "clock_filter.hpp"
+#include "clock_drift.hpp"
+#include "clock_anomaly.hpp"
+#include "clock_rounds.hpp"
+#include "clock_registry.hpp"
+#include "clock_writer.hpp"
+#include "clock_log.hpp"
 
 using namespace std;
+//
+//***********************************************************************************************
+//
+// Class clock_stats_table: Table of the per-client sample buffers of a period, indexed by the
+//                          registry slot of the client. Client slots and their sample buffers
+//                          are kept (and recycled) across periods.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_stats_table {
+
+public:
+
+    // Declare a client slot
+    struct clock_slot
+    {
+           bool used {false};
+           uint32_t server_id {0};
+           uint32_t clock_id {0};
+           vector<int64_t> samples;
+           clock_sketch sketch;
+           clock_drift fit;
+           ClockDriftEstimate drift;
+           clock_anomaly::clock_baseline* baseline {nullptr};
+
+           // Get the number of points in this period
+           uint64_t GetCount () const { return samples.size() + sketch.GetCount(); }
+    };
+
+private:
+
+    // Declare the slots
+    vector<clock_slot> slots;
+
+public:
+
+    // Constructor
+    clock_stats_table() {}
+
+    // Get the slot of the client registered in registry slot pSlot (a slot taken over by another
+    // client after an expiry is handed over empty, the period having been recycled)
+    clock_slot & GetSlot (uint32_t pSlot, uint32_t pServerID, uint32_t pClockID)
+    {
+         if (pSlot >= slots.size())
+         {
+             slots.resize(max<size_t>(pSlot + 1, slots.size() * 2));
+         }
+
+         clock_slot & slot = slots[pSlot];
+         slot.used      = true;
+         slot.server_id = pServerID;
+         slot.clock_id  = pClockID;
+         return slot;
+    }
+
+    // Get the number of points of registry slot pSlot in this period
+    uint64_t GetCount (uint32_t pSlot) const
+    {
+         return pSlot < slots.size() ? slots[pSlot].GetCount() : 0;
+    }
+
+    // Get all slots (empty slots have used == false)
+    vector<clock_slot> & GetSlots () { return slots; }
+
+    // Reset all sample buffers and sketches for the next period (keeping slots and buffer capacity)
+    void Recycle ()
+    {
+         for (auto & slot : slots)
+         {
+              slot.samples.clear();
+              slot.sketch.Reset();
+              slot.fit   = clock_drift();
+              slot.drift = ClockDriftEstimate();
+              slot.baseline = nullptr;
+         }
+    }
+};
+
 //
 //***********************************************************************************************
 //
@@ -23,118 +116,762 @@ using namespace std;
 //
 class clock_stats {
 
+    // Declare number of shards (power of two) arbitrating adding to sample population
+    enum { shard_count = 16 };
+
+    // Declare number of registry slots whose rounds are closed per hold of a shard lock
+    enum { close_batch = 256 };
+
+    // Declare a shard: the registry of its clients, a double-buffered table (active one receives
+    // points) and the delay filters, drift estimators, round trackers and anomaly baselines (sized on
+    // the first period with a detector, and only touched by the recorder) of its clients (kept across
+    // periods), all indexed by registry slot, the filter, round and client counts of the period and its mutex
+    struct clock_stats_shard
+    {
+           mutex mx;
+           unsigned active {0};
+           clock_registry registry;
+           clock_stats_table tables[2];
+           vector<clock_filter> filters;
+           vector<clock_drift> drifts;
+           vector<clock_rounds> rounds;
+           vector<clock_anomaly::clock_baseline> baselines;
+           uint64_t checked {0};
+           uint64_t rejected {0};
+           ClockRoundCounts round_counts;
+           uint64_t joined {0};
+
+           // Get the registry slot of a client (a client registered on first contact starts afresh)
+           uint32_t Register (uint32_t pServerID, uint32_t pClockID)
+           {
+                bool added;
+                uint32_t slot = registry.Register(pServerID, pClockID, added);
+                if (added)
+                {
+                    if (slot >= filters.size())
+                    {
+                        size_t capacity = max<size_t>(registry.GetCapacity(), filters.size() * 2);
+                        filters.resize(capacity);
+                        drifts.resize(capacity);
+                        rounds.resize(capacity);
+                    }
+
+                    filters[slot] = clock_filter();
+                    drifts[slot]  = clock_drift();
+                    rounds[slot]  = clock_rounds();
+                    joined++;
+                }
+
+                return slot;
+           }
+    };
+
     // Declare file to which stats are persisted
-    const string cstrFileName {"./clock_server.out"};
+    const string cstrFileName;
+
+    // Declare mutex serializing persistence of statistics
+    mutex record_mx;
+
+    // Declare the statistics cumulative collection (sharded by server clock and client id)
+    clock_stats_shard shards[shard_count];
+
+    // Declare the streaming mode (sketch per client instead of storing every sample)
+    bool streaming;
+
+    // Declare the delay filter window (0 disables filtering) and tolerance (microseconds)
+    atomic<uint32_t> filter_window;
+    atomic<int64_t> filter_tolerance;
+
+    // Declare the delay filter counts of the last recorded period (checked, rejected)
+    pair<uint64_t, uint64_t> filter_counts;
 
-    // Declare mutex to arbitrate taking stats and adding to sample population
-    mutex mx;
+    // Declare the broadcast log of every hosted server clock (by clock index) and the round counts of
+    // the last recorded period
+    vector<clock_broadcasts> broadcasts;
+    ClockRoundCounts round_counts;
 
-    // Declare the output file 
-    ofstream out_file;
+    // Declare the half-life of the drift estimators (seconds, 0 disables them) and the client
+    // with the largest frequency error in the last recorded period
+    atomic<uint32_t> drift_halflife;
+    pair<string, ClockDriftEstimate> drift_peak;
 
-    // Declare the statistics cumulative collection
-    map<uint32_t, vector <int64_t>> stats;
+    // Declare the idle time after which a silent client is forgotten (seconds, 0 never), the start of
+    // the period (last seen time of the replies added without a receive time) and the client counts of
+    // the last recorded period
+    atomic<uint32_t> client_idle;
+    atomic<uint64_t> period_start_ns;
+    ClockClientCounts client_counts;
+
+    // Declare the optional anomaly detector over the periods, its alerts file and the number of
+    // alerts of the last recorded period
+    unique_ptr<clock_anomaly> anomaly;
+    string alerts_file;
+    uint64_t alert_count {0};
+
+    // Declare the background writer of the output file
+    clock_writer writer;
+
+#if defined UNIX
+    // Declare the optional binary log of the statistics periods
+    unique_ptr<clock_log> binary_log;
+#endif
 
 public:
 
-    // Constructor
-    clock_stats() {}
+    // Constructor (fsync policy: -1 never, 0 every period, N at most every N seconds)
+    clock_stats(bool pStreaming = false, int piFsyncInterval = -1, string const & psFileName = "./clock_server.out") : 
+
+                cstrFileName     (psFileName),
+                streaming        (pStreaming), 
+                filter_window    (0),
+                filter_tolerance (0),
+                drift_halflife   (0),
+                client_idle      (0),
+                period_start_ns  (GetCurrentTime_ns()),
+                writer           (cstrFileName, piFsyncInterval) 
+    {
+    }
+
+    // Discard points whose round-trip delay exceeds the minimum of the client's last piWindow delays
+    // by more than piTolerance microseconds (piWindow 0 disables the filter)
+    void SetDelayFilter (uint32_t piWindow, int64_t piTolerance)
+    {
+         filter_window.store(min<uint32_t>(piWindow, clock_filter::max_window), memory_order_relaxed);
+         filter_tolerance.store(piTolerance, memory_order_relaxed);
+    }
+
+    // Get the delay filter counts of the last recorded period (checked, rejected)
+    pair<uint64_t, uint64_t> GetFilterCounts ()
+    {
+         lock_guard<mutex> lock(record_mx);
+         return filter_counts;
+    }
+
+    // Track the broadcast rounds of piClocks hosted server clocks (set before any point is added)
+    void SetBroadcastClocks (size_t piClocks)
+    {
+         vector<clock_broadcasts>(piClocks).swap(broadcasts);
+    }
+
+    // Record the broadcast of round pRound of hosted clock pClock at pTime_ns: replies to earlier rounds
+    // received from then on are late, and the rounds before it are over (missed by clients not answering)
+    void SetRound (uint32_t pClock, uint32_t pRound, uint64_t pTime_ns)
+    {
+         broadcasts[pClock].Start(pRound, pTime_ns);
+    }
+
+    // Get the round being broadcast by hosted clock pClock (0 before any)
+    uint32_t GetRound (uint32_t pClock) const
+    {
+         return broadcasts[pClock].GetRound();
+    }
+
+    // Get the round counts of the last recorded period (replies in time, rounds missed, late and duplicate replies)
+    ClockRoundCounts GetRoundCounts ()
+    {
+         lock_guard<mutex> lock(record_mx);
+         return round_counts;
+    }
+
+    // Forget the clients silent for piIdle seconds (0 keeps them all): their state is released at the end
+    // of a period and their slots reused
+    void SetClientExpiry (uint32_t piIdle)
+    {
+         client_idle.store(piIdle, memory_order_relaxed);
+    }
+
+    // Get the client counts of the last recorded period (registered at its end, registered and expired in it)
+    ClockClientCounts GetClientCounts ()
+    {
+         lock_guard<mutex> lock(record_mx);
+         return client_counts;
+    }
+
+    // Fit the offset of every client against time, weighting samples down by half every piHalfLife
+    // seconds (0 disables the fit); each statistics line then ends with offset,ppm,jitter
+    void SetDriftEstimator (uint32_t piHalfLife)
+    {
+         drift_halflife.store(piHalfLife, memory_order_relaxed);
+    }
+
+    // Detect spikes, step changes, reply count drops and silent clients over the periods (alerts beyond
+    // pThreshold robust standard deviations), appending alert records to psFileName
+    void SetAnomalyDetector (string const & psFileName, double pThreshold)
+    {
+         lock_guard<mutex> lock(record_mx);
+         anomaly.reset(new clock_anomaly(pThreshold));
+         alerts_file = psFileName;
+    }
+
+    // Get the number of alerts of the last recorded period
+    uint64_t GetAlertCount ()
+    {
+         lock_guard<mutex> lock(record_mx);
+         return alert_count;
+    }
+
+    // Get the client ([server clock,]client id) with the largest frequency error of the last recorded period
+    pair<string, ClockDriftEstimate> GetDriftPeak ()
+    {
+         lock_guard<mutex> lock(record_mx);
+         return drift_peak;
+    }
+
+#if defined UNIX
+    // Also persist the statistics periods to binary log segments <prefix>.NNNNNN.bin
+    void SetBinaryLog (string const & psPrefix, uint64_t piSegmentRecords)
+    {
+         lock_guard<mutex> lock(record_mx);
+         binary_log.reset(new clock_log(psPrefix, piSegmentRecords));
+    }
+#endif
 
     // Clear stats collection
     void Clear ()
     {
-         stats.clear();
+         for (auto & shard : shards)
+         {
+              lock_guard<mutex> lock(shard.mx);
+              shard.tables[0].Recycle();
+              shard.tables[1].Recycle();
+         }
     }
 
     // Add point to statistics collection
     void AddPoint(uint32_t pClockID, int64_t offset) 
     {
-        // Lock while processing this point 
-        lock_guard<mutex> lock(mx);
+        clock_metrics_scope timing (LATENCY_ADDPOINT, true);
 
-         // Check if this client is already available
-         if (stats.count(pClockID) > 0) 
-         {
-             // Add a new point to this clock client
-             stats[pClockID].push_back(offset);
-         }
-         else 
-         {
-             // Add a new collection for this new client and add the current point
-             vector<int64_t> vec;
-             vec.push_back(offset);
-             stats[pClockID] = vec;
-         }
+        // Lock only the shard of this client while processing this point 
+        clock_stats_shard & shard = GetShard(0, pClockID);
+        LockShard(shard);
+        lock_guard<mutex> lock(shard.mx, adopt_lock);
+
+        uint32_t slot = shard.Register(0, pClockID);
+        Touch(shard, slot, 0);
+        AddPoint(shard, slot, 0, pClockID, offset);
+    }
+
+    // Add point with its round-trip delay to statistics collection (subject to the delay filter)
+    void AddPoint(uint32_t pClockID, int64_t offset, int64_t delay) 
+    {
+        AddPoint(0, pClockID, offset, delay);
+    }
+
+    // Add point of a client of a server clock with its round-trip delay (server clock 0 for a server
+    // hosting a single clock: its statistics lines carry no server clock column) taken at pTime_ns
+    // (points without a time are not fitted by the drift estimator), replying to broadcast round
+    // pSequence of hosted clock pClock (points without a round are not tracked)
+    void AddPoint(uint32_t pServerID, uint32_t pClockID, int64_t offset, int64_t delay, uint64_t pTime_ns = 0, uint32_t pSequence = 0, uint32_t pClock = 0) 
+    {
+        clock_metrics_scope timing (LATENCY_ADDPOINT, true);
+
+        // Lock only the shard of this client while processing this point 
+        clock_stats_shard & shard = GetShard(pServerID, pClockID);
+        LockShard(shard);
+        lock_guard<mutex> lock(shard.mx, adopt_lock);
+
+        // Find the client in the registry of the shard (its state is then indexed by slot)
+        uint32_t slot = shard.Register(pServerID, pClockID);
+        Touch(shard, slot, pTime_ns);
+
+        // Keep late replies (received once the next round went out) and duplicates out of the statistics
+        if (pSequence > 0 && pClock < broadcasts.size())
+        {
+            shard.registry.GetClient(slot).clock_index = pClock;
+
+            switch (shard.rounds[slot].Check(pSequence, broadcasts[pClock].GetRoundAt(pSequence, pTime_ns), shard.round_counts.missed))
+            {
+                case ROUND_LATE:
+                     shard.round_counts.late++;
+                     clock_metrics::Add(METRIC_REPLIES_LATE);
+                     return;
+
+                case ROUND_DUPLICATE:
+                     shard.round_counts.duplicate++;
+                     clock_metrics::Add(METRIC_REPLIES_DUPLICATE);
+                     return;
+
+                case ROUND_ON_TIME:
+                     shard.round_counts.on_time++;
+                     break;
+            }
+        }
+
+        // Discard high-delay samples before they reach the statistics
+        uint32_t window = filter_window.load(memory_order_relaxed);
+        if (window > 0)
+        {
+            shard.checked++;
+            if (!shard.filters[slot].Accept(delay, window, filter_tolerance.load(memory_order_relaxed)))
+            {
+                shard.rejected++;
+                clock_metrics::Add(METRIC_REPLIES_FILTERED);
+                return;
+            }
+        }
+
+        // Fit the accepted sample against its time (the period keeps the fit as of its last sample)
+        clock_stats_table::clock_slot & period = AddPoint(shard, slot, pServerID, pClockID, offset);
+        uint32_t halflife = drift_halflife.load(memory_order_relaxed);
+        if (halflife > 0 && pTime_ns > 0)
+        {
+            shard.drifts[slot].Add(pTime_ns, offset, halflife);
+            period.fit = shard.drifts[slot];
+        }
     }
 
+    // Add the points of the calling thread to one shard (a reply collector thread then never contends
+    // for its shard): only for a thread receiving every point of its clients, whose state is kept in
+    // the shard that sees their points
+    static void BindShard (uint32_t pIndex)
+    {
+        GetBoundShard() = static_cast<int>(pIndex & (shard_count - 1));
+    }
+
+private:
+
+    // Get the shard bound to the calling thread (-1 if none)
+    static int & GetBoundShard ()
+    {
+        static thread_local int bound_shard {-1};
+        return bound_shard;
+    }
+
+    // Get the shard of a client (the bound shard of the calling thread, if any)
+    clock_stats_shard & GetShard (uint32_t pServerID, uint32_t pClockID)
+    {
+        int bound = GetBoundShard();
+        return shards[bound >= 0 ? bound : (clock_registry::Hash(pServerID, pClockID) >> 24) & (shard_count - 1)];
+    }
+
+    // Lock a shard, accounting the wait when another thread holds it
+    static void LockShard (clock_stats_shard & shard)
+    {
+        if (!shard.mx.try_lock())
+        {
+            clock_metrics::Add(METRIC_STATS_LOCK_WAITS);
+            clock_metrics_scope wait (LATENCY_LOCK_WAIT);
+            shard.mx.lock();
+        }
+    }
+
+    // Account a reply of the client of a registry slot of a (locked) shard, received at pTime_ns (if 0,
+    // the start of the period: expiry goes by periods, and the clock is not read per reply)
+    void Touch (clock_stats_shard & shard, uint32_t pSlot, uint64_t pTime_ns)
+    {
+        ClockClientState & client = shard.registry.GetClient(pSlot);
+        client.last_seen_ns = pTime_ns > 0 ? pTime_ns : period_start_ns.load(memory_order_relaxed);
+        client.replies++;
+    }
+
+    // Add point of the client of a registry slot to the active table of a (locked) shard, returning its
+    // slot of the period
+    clock_stats_table::clock_slot & AddPoint(clock_stats_shard & shard, uint32_t pSlot, uint32_t pServerID, uint32_t pClockID, int64_t offset)
+    {
+        clock_metrics::Add(METRIC_REPLIES_ACCEPTED);
+        shard.registry.GetClient(pSlot).last_offset = offset;
+
+        // Add a new point to this clock client (its buffer is reused from previous periods)
+        clock_stats_table::clock_slot & slot = shard.tables[shard.active].GetSlot(pSlot, pServerID, pClockID);
+        if (streaming)
+        {
+            slot.sketch.Add(offset);
+        }
+        else
+        {
+            slot.samples.push_back(offset);
+        }
+
+        return slot;
+    }
+
+    // Account the rounds over that the clients of a shard missed, replies or not (clients missing every
+    // remembered round are dropped), a batch of slots per hold of the shard lock
+    void CloseRounds (clock_stats_shard & shard)
+    {
+        for (uint32_t first=0; ; first += close_batch)
+        {
+             lock_guard<mutex> shard_lock(shard.mx);
+             uint32_t last = min<uint32_t>(first + close_batch, shard.registry.GetCapacity());
+             if (first >= last)
+             {
+                 return;
+             }
+
+             for (uint32_t i=first; i<last; i++)
+             {
+                  ClockClientState const & client = shard.registry.GetClient(i);
+                  uint32_t current = client.clock_index < broadcasts.size() ? broadcasts[client.clock_index].GetRound() : 0;
+                  if (client.used && !shard.rounds[i].Close(current, round_counts.missed))
+                  {
+                      shard.rounds[i] = clock_rounds();
+                  }
+             }
+        }
+    }
+
+    // Move the per-slot entries of a shard array to the new slots of their clients (after the registry
+    // moved them down), dropping the entries of released clients
+    template <typename T> static void MoveSlots (vector<T> & poItems, vector<uint32_t> const & poMoved, size_t piCapacity)
+    {
+        vector<T> items (piCapacity);
+        for (size_t i=0; i<poItems.size() && i<poMoved.size(); i++)
+        {
+             if (poMoved[i] != clock_registry::no_slot)
+             {
+                 items[poMoved[i]] = move(poItems[i]);
+             }
+        }
+        poItems.swap(items);
+    }
+
+public:
+
     // Persist statistics to a file 
     void RecordStatistics()
     {
-        // Lock while recording stats to avoid contention if adding points
-        lock_guard<mutex> lock(mx);
+        // Serialize recording (points keep being added to the active tables meanwhile)
+        lock_guard<mutex> lock(record_mx);
+        clock_metrics_scope timing (LATENCY_RECORD);
+
+        // Snapshot the period: swap the active table of every shard and take its filter and round counts
+        // (collectors never wait on the size of the fleet)
+        bool drifting = drift_halflife.load(memory_order_relaxed) > 0;
+        filter_counts = make_pair(0, 0);
+        round_counts  = ClockRoundCounts();
+        for (auto & shard : shards)
+        {
+             lock_guard<mutex> shard_lock(shard.mx);
+             shard.active ^= 1;
+
+             filter_counts.first  += shard.checked;
+             filter_counts.second += shard.rejected;
+             shard.checked = shard.rejected = 0;
+
+             round_counts.on_time   += shard.round_counts.on_time;
+             round_counts.missed    += shard.round_counts.missed;
+             round_counts.late      += shard.round_counts.late;
+             round_counts.duplicate += shard.round_counts.duplicate;
+             shard.round_counts = ClockRoundCounts();
+        }
+
+        // Then account the rounds over, with a short hold of the shard lock per batch of clients
+        for (auto & shard : shards)
+        {
+             CloseRounds(shard);
+        }
+
+        // Take the drift estimates and anomaly baselines of the clients of the period from the swapped-out
+        // tables (no collector adds to them, and the baselines belong to the recorder)
+        for (auto & shard : shards)
+        {
+             vector<clock_stats_table::clock_slot> & slots = shard.tables[shard.active ^ 1].GetSlots();
+             if (anomaly && shard.baselines.size() < slots.size())
+             {
+                 shard.baselines.resize(slots.size());
+             }
+
+             if (drifting || anomaly)
+             {
+                 for (size_t i=0; i<slots.size(); i++)
+                 {
+                      if (slots[i].used && slots[i].GetCount() > 0)
+                      {
+                          if (drifting)
+                          {
+                              slots[i].drift = slots[i].fit.GetEstimate();
+                          }
+                          if (anomaly)
+                          {
+                              slots[i].baseline = &shard.baselines[i];
+                          }
+                      }
+                 }
+             }
+        }
+
+        // Collect the clients with samples in this period (in server clock and client id order)
+        vector<clock_stats_table::clock_slot*> period;
+        for (auto & shard : shards)
+        {
+             for (auto & slot : shard.tables[shard.active ^ 1].GetSlots())
+             {
+                  if (slot.used && slot.GetCount() > 0)
+                  {
+                      period.push_back(&slot);
+                  }
+             }
+        }
+
+        sort(period.begin(), period.end(), [](clock_stats_table::clock_slot* a, clock_stats_table::clock_slot* b)
+        {
+             return a->server_id != b->server_id ? a->server_id < b->server_id : a->clock_id < b->clock_id;
+        });
+
+        clock_metrics::Set(METRIC_PERIOD_CLIENTS, period.size());
+        clock_metrics::Add(METRIC_ROUNDS_MISSED, round_counts.missed);
+
+        // Take the period time stamp once for all clients
+        uint64_t period_us = get_current_us_epoch();
+        string sTimeStamp  = ConvertEpochToTime_us(period_us);
+        vector<ClockAlert> alerts;
 
         // Ensure that there is data to report
-        if (stats.size() > 0) 
+        if (period.size() > 0) 
         {
-            // Open file
-            out_file.open (cstrFileName, ofstream::out | ofstream::app);
+            // Summarize every client of the period
+            vector<ClockLogRecord> records (period.size());
+            for (size_t i=0; i<period.size(); i++)
+            {
+                 if (streaming)
+                 {
+                     Summarize(period[i]->sketch, records[i]);
+                 }
+                 else
+                 {
+                     Summarize(period[i]->samples, records[i]);
+                 }
+
+                 records[i].timestamp_us = period_us;
+                 records[i].clock_id     = period[i]->clock_id;
+                 records[i].server_id    = period[i]->server_id;
 
-            // Declare iterator for clock client collections
-            map<uint32_t, vector<int64_t>>::iterator it;
+                 if (anomaly)
+                 {
+                     anomaly->Check(*period[i]->baseline, records[i].server_id, records[i].clock_id, records[i].count, records[i].min, records[i].median, records[i].max, alerts);
+                 }
+            }
+
+            // Build the statistics edit lines of all clients in one buffer (with their drift estimates)
+            string sRecord;
+            sRecord.reserve(period.size() * (drifting ? 96 : 64));
+            drift_peak = make_pair(string(), ClockDriftEstimate());
 
-            // Iterate over all collections
-            for (it=stats.begin(); it != stats.end(); it++)
+            for (size_t i=0; i<records.size(); i++)
             {
-                 // Declare the stream for string edit
-                 ostringstream stats_stream;
-
-                 // Build the statistics edit line for this specific clock client
-                 stats_stream <<  ConvertEpochToTime_us() << "," << to_string(it->first) << "," << ComputeStatistics(it->second);
-              
-                 // Perform the i/o to the file
-                 out_file << stats_stream.str() << endl;
-                 out_file.flush();
+                 sRecord += sTimeStamp;
+                 sRecord += ",";
+                 sRecord += FormatClient(records[i]);
+                 sRecord += ",";
+                 sRecord += FormatStatistics(records[i]);
+
+                 ClockDriftEstimate const & drift = period[i]->drift;
+                 if (drift.valid)
+                 {
+                     sRecord += ",";
+                     sRecord += FormatDrift(drift);
+
+                     if (!drift_peak.second.valid || fabs(drift.ppm) > fabs(drift_peak.second.ppm))
+                     {
+                         drift_peak = make_pair(FormatClient(records[i]), drift);
+                     }
+                 }
+
+                 sRecord += "\n";
             }
 
-            // Close the file
-            out_file.close();
+            // Hand the period over to the writer thread for a single write to the file
+            writer.Write(move(sRecord));
 
-            // Reset collections for next sample period
-            Clear();
+#if defined UNIX
+            // Hand the fixed-width records over for the binary log (counted in their segment once accepted)
+            if (binary_log)
+            {
+                string sBinary;
+                string sSegment = binary_log->Append(records, sBinary);
+                if (writer.Write(move(sBinary), sSegment))
+                {
+                    binary_log->Commit();
+                }
+            }
+#endif
         }
+
+        // Report the alerts of the period (silent clients included)
+        if (anomaly)
+        {
+            for (auto & shard : shards)
+            {
+                 for (auto & base : shard.baselines)
+                 {
+                      anomaly->CheckSilent(base, alerts);
+                 }
+            }
+
+            anomaly->EndPeriod();
+            alert_count = alerts.size();
+            clock_metrics::Add(METRIC_ALERTS, alerts.size());
+
+            if (!alerts.empty())
+            {
+                writer.Write(FormatAlerts(sTimeStamp, alerts), alerts_file);
+            }
+        }
+
+        // Recycle the snapshot buffers for the period after next
+        for (auto & shard : shards)
+        {
+             shard.tables[shard.active ^ 1].Recycle();
+        }
+
+        // Forget the clients silent for the idle time (a client with points in the current period stays)
+        // and count the live fleet
+        uint32_t idle = client_idle.load(memory_order_relaxed);
+        uint64_t now_ns = GetCurrentTime_ns();
+        period_start_ns.store(now_ns, memory_order_relaxed);
+        client_counts = ClockClientCounts();
+        vector<uint32_t> moved;
+        for (auto & shard : shards)
+        {
+             lock_guard<mutex> shard_lock(shard.mx);
+
+             if (idle > 0 && now_ns > idle * 1000000000ULL)
+             {
+                 clock_stats_table & current = shard.tables[shard.active];
+                 client_counts.expired += shard.registry.Expire(now_ns - idle * 1000000000ULL, [&current](uint32_t pSlot) { return current.GetCount(pSlot) > 0; }, moved);
+
+                 // Follow the clients moved down to the first slots
+                 if (!moved.empty())
+                 {
+                     size_t capacity = shard.registry.GetCapacity();
+                     MoveSlots(shard.filters, moved, capacity);
+                     MoveSlots(shard.drifts, moved, capacity);
+                     MoveSlots(shard.rounds, moved, capacity);
+                     if (!shard.baselines.empty())
+                     {
+                         MoveSlots(shard.baselines, moved, capacity);
+                     }
+                     MoveSlots(shard.tables[0].GetSlots(), moved, capacity);
+                     MoveSlots(shard.tables[1].GetSlots(), moved, capacity);
+                 }
+             }
+
+             client_counts.active += shard.registry.GetActive();
+             client_counts.joined += shard.joined;
+             shard.joined = 0;
+        }
+
+        clock_metrics::Set(METRIC_ACTIVE_CLIENTS, client_counts.active);
+        clock_metrics::Add(METRIC_CLIENTS_EXPIRED, client_counts.expired);
     }
 
-    // Compute statistics
-    string ComputeStatistics (vector<int64_t> vec)
+    // Compute statistics (the samples are reordered in place)
+    string ComputeStatistics (vector<int64_t> & vec)
     {
-        // Declare edit for computed stats
-        string sEdit;
-    
+        ClockLogRecord record;
+        Summarize(vec, record);
+        return FormatStatistics(record);
+    }
+
+    // Compute statistics from a streaming sketch (median reported as p50, followed by p90, p99, p99.9)
+    string ComputeStatistics (clock_sketch const & sketch)
+    {
+        ClockLogRecord record;
+        Summarize(sketch, record);
+        return FormatStatistics(record);
+    }
+
+    // Summarize the samples of a period into a cleared record (the samples are reordered in place)
+    void Summarize (vector<int64_t> & vec, ClockLogRecord & record)
+    {
+        record = ClockLogRecord();
+
         // Ensure there are elements in the collection
         if (vec.size() > 0) 
         {
             // Compute max and min
-            int64_t min_elem = *(min_element(begin(vec), end(vec)));
-            int64_t max_elem = *(max_element(begin(vec), end(vec)));
+            record.min = *(min_element(begin(vec), end(vec)));
+            record.max = *(max_element(begin(vec), end(vec)));
 
             // Compute average
             double sum  = accumulate(vec.begin(), vec.end(), 0.0);
             double mean = sum / vec.size();
-            int64_t avg_elem = static_cast<int64_t>(mean);
+            record.avg  = static_cast<int64_t>(mean);
 
             // Compute median
             nth_element(vec.begin(), vec.begin() + vec.size()/2, vec.end());
-            int64_t med_elem = vec[vec.size()/2];
+            record.median = vec[vec.size()/2];
+            record.count  = vec.size();
+        }
+    }
+
+    // Summarize a streaming sketch of a period into a cleared record
+    void Summarize (clock_sketch const & sketch, ClockLogRecord & record)
+    {
+        record = ClockLogRecord();
+
+        // Ensure there are elements in the sketch
+        if (sketch.GetCount() > 0)
+        {
+            record.count  = sketch.GetCount();
+            record.min    = sketch.GetMin();
+            record.avg    = sketch.GetMean();
+            record.median = sketch.GetQuantile(0.5);
+            record.max    = sketch.GetMax();
+            record.p90    = sketch.GetQuantile(0.9);
+            record.p99    = sketch.GetQuantile(0.99);
+            record.p999   = sketch.GetQuantile(0.999);
+            record.flags  = quantiles_flag;
+        }
+    }
+
+    // Format the client of a record: [server clock,]client id (no server clock column on single clock servers)
+    static string FormatClient (ClockLogRecord const & record)
+    {
+        return FormatClient(record.server_id, record.clock_id);
+    }
+
+    static string FormatClient (uint32_t pServerID, uint32_t pClockID)
+    {
+        return pServerID != 0 ? to_string(pServerID) + "," + to_string(pClockID) : to_string(pClockID);
+    }
+
+    // Format the alerts of a period: timestamp,[server clock,]client id,kind,value,baseline,scale
+    static string FormatAlerts (string const & psTimeStamp, vector<ClockAlert> const & poAlerts)
+    {
+        string sAlerts;
+        for (auto const & alert : poAlerts)
+        {
+             sAlerts += psTimeStamp + "," + FormatClient(alert.server_id, alert.clock_id) + "," + GetAlertName(alert.kind) + ","
+                      + to_string(alert.value) + "," + to_string(alert.baseline) + "," + to_string(alert.scale) + "\n";
+        }
+
+        return sAlerts;
+    }
+
+    // Format the statistics of a period: count,min,avg,median,max[,p90,p99,p99.9]
+    static string FormatStatistics (ClockLogRecord const & record)
+    {
+        // Declare edit for computed stats
+        string sEdit;
 
+        // Ensure there are elements in the record
+        if (record.count > 0)
+        {
             // Compose edit
             ostringstream ostream;
-            ostream << setprecision(0) << vec.size() << ","  << min_elem << "," << avg_elem << "," << med_elem << "," << max_elem;
+            ostream << record.count << "," << record.min << "," << record.avg << "," << record.median << "," << record.max;
+
+            if (record.flags & quantiles_flag)
+            {
+                ostream << "," << record.p90 << "," << record.p99 << "," << record.p999;
+            }
+
             sEdit = ostream.str();
         }
 
         return sEdit;
     }
 
+    // Format a drift estimate: offset,ppm,jitter (microseconds, ppm to the nanosecond per second)
+    static string FormatDrift (ClockDriftEstimate const & drift)
+    {
+        ostringstream ostream;
+        ostream << drift.offset << "," << fixed << setprecision(3) << drift.ppm << "," << llround(drift.jitter);
+        return ostream.str();
+    }
+
     // Get current microseconds since epoch
     long long get_current_us_epoch() 
     {
@@ -145,22 +882,12 @@ public:
     string ConvertEpochToTime_us()
     {
        // Get Current microseconds since epoch
-       long long micSecondsSinceEpoch = get_current_us_epoch();
-
-       // Get time after duration
-       const auto durationSinceEpoch = chrono::microseconds(micSecondsSinceEpoch);
-       const chrono::time_point<chrono::system_clock> tp_after_duration(durationSinceEpoch);
-       time_t time_after_duration = chrono::system_clock::to_time_t(tp_after_duration);
-       localtime(&time_after_duration);
-
-       // Calculate remainder in microseconds
-       long long int micseconds_remainder = micSecondsSinceEpoch % 1000000;
-
-       // Build date edit
-       ostringstream ostring;
-       ostring <<put_time(localtime(&time_after_duration), "%Y-%m-%d %H:%M:%S.") << micseconds_remainder;
+       return ConvertEpochToTime_us(get_current_us_epoch());
+    }
 
-       // Return edit date with microsecond precision
-       return ostring.str();
+    // Convert a given epoch (in microseconds) to datetime edit with microsecond precision
+    string ConvertEpochToTime_us(long long micSecondsSinceEpoch)
+    {
+       return FormatEpochTime_us(micSecondsSinceEpoch);
     }
 };
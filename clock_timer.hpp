@@ -1,16 +1,226 @@
 #include <cstdlib>
 #include <iostream>
 #include <algorithm>
+#include <functional>
+#include <vector>
+#include <map>
+#include <queue>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <chrono>
 #include <atomic>
 
 using namespace std;
+//
+//***********************************************************************************************
+//
+// Class clock_scheduler: Single thread running many periodic timers. Ticks are scheduled on
+//                        absolute steady_clock deadlines (start + n * period) so the period does
+//                        not drift by the callback duration; lateness of every tick is recorded.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_scheduler
+{
+        // Declare a scheduled timer
+        struct clock_timer_entry
+        {
+               chrono::steady_clock::duration period;
+               function<void(void)> func;
+               ClockTimerLateness lateness;
+        };
+
+        // Declare a deadline in the heap (stale once its timer is cancelled or rescheduled)
+        typedef pair<chrono::steady_clock::time_point, uint64_t> clock_deadline;
+
+        // Declare the timers, their deadlines (min-heap) and the next timer id
+        map<uint64_t, clock_timer_entry> timers;
+        priority_queue<clock_deadline, vector<clock_deadline>, greater<clock_deadline>> deadlines;
+        map<uint64_t, chrono::steady_clock::time_point> next_deadline;
+        uint64_t next_id {1};
+
+        // Declare the timer running its callback (0 if none)
+        uint64_t running_id {0};
+
+        // Declare the state, wakeup and the scheduler thread
+        bool exec {true};
+        mutex mx;
+        condition_variable cv;
+        condition_variable done_cv;
+        thread oSchedulerThread;
+
+public:
+
+        // Constructor
+        clock_scheduler ()
+        {
+             oSchedulerThread = thread(&clock_scheduler::Run, this);
+        }
+
+        // Destructor
+        ~clock_scheduler ()
+        {
+             {
+                 lock_guard<mutex> lock(mx);
+                 exec = false;
+             }
+             cv.notify_one();
+
+             if (oSchedulerThread.joinable())
+             {
+                 oSchedulerThread.join();
+             }
+        }
+
+        // Get the scheduler shared by all clock_timer instances
+        static clock_scheduler & GetDefault ()
+        {
+             static clock_scheduler scheduler;
+             return scheduler;
+        }
+
+        // Add a timer firing every piInterval milliseconds (first tick after one interval); returns its id
+        uint64_t Add (int piInterval, function<void(void)> func)
+        {
+             lock_guard<mutex> lock(mx);
+
+             uint64_t id = next_id++;
+             clock_timer_entry & entry = timers[id];
+             entry.period = chrono::milliseconds(max(piInterval, 1));
+             entry.func   = func;
+
+             Schedule(id, chrono::steady_clock::now() + entry.period);
+             cv.notify_one();
+
+             return id;
+        }
+
+        // Change the period of a timer (takes effect from the next tick)
+        void SetInterval (uint64_t pId, int piInterval)
+        {
+             lock_guard<mutex> lock(mx);
+
+             auto it = timers.find(pId);
+             if (it != timers.end())
+             {
+                 auto period = chrono::milliseconds(max(piInterval, 1));
+                 Schedule(pId, next_deadline[pId] - it->second.period + period);
+                 it->second.period = period;
+                 cv.notify_one();
+             }
+        }
+
+        // Cancel a timer; once this returns its callback is not running and will not run again
+        void Cancel (uint64_t pId)
+        {
+             unique_lock<mutex> lock(mx);
+
+             timers.erase(pId);
+             next_deadline.erase(pId);
+             cv.notify_one();
+
+             // Wait for a callback in progress (unless cancelling from within it)
+             if (this_thread::get_id() != oSchedulerThread.get_id())
+             {
+                 done_cv.wait(lock, [this, pId] { return running_id != pId; });
+             }
+        }
+
+        // Check if a timer is scheduled
+        bool IsScheduled (uint64_t pId)
+        {
+             lock_guard<mutex> lock(mx);
+             return timers.count(pId) > 0;
+        }
+
+        // Get the lateness statistics of a timer
+        ClockTimerLateness GetLateness (uint64_t pId)
+        {
+             lock_guard<mutex> lock(mx);
+
+             auto it = timers.find(pId);
+             return it != timers.end() ? it->second.lateness : ClockTimerLateness();
+        }
+
+private:
+
+        // Schedule the next tick of a timer
+        void Schedule (uint64_t pId, chrono::steady_clock::time_point pDeadline)
+        {
+             next_deadline[pId] = pDeadline;
+             deadlines.push(make_pair(pDeadline, pId));
+        }
+
+        // Scheduler loop
+        void Run ()
+        {
+             unique_lock<mutex> lock(mx);
+
+             while (exec)
+             {
+                  // Sleep until the earliest deadline (or until a timer is added or cancelled)
+                  if (deadlines.empty())
+                  {
+                      cv.wait(lock);
+                      continue;
+                  }
+
+                  clock_deadline next = deadlines.top();
+                  if (chrono::steady_clock::now() < next.first)
+                  {
+                      cv.wait_until(lock, next.first);
+                      continue;
+                  }
+
+                  deadlines.pop();
+
+                  // Skip deadlines of cancelled or rescheduled timers
+                  auto it = timers.find(next.second);
+                  if (it == timers.end() || next_deadline[next.second] != next.first)
+                  {
+                      continue;
+                  }
+
+                  // Record the lateness of this tick
+                  auto now = chrono::steady_clock::now();
+                  int64_t late_us = chrono::duration_cast<chrono::microseconds>(now - next.first).count();
+                  ClockTimerLateness & lateness = it->second.lateness;
+                  lateness.ticks++;
+                  lateness.last_us   = late_us;
+                  lateness.max_us    = max(lateness.max_us, late_us);
+                  lateness.total_us += late_us;
+
+                  // Schedule the next tick on the absolute grid, skipping ticks already missed
+                  auto deadline = next.first + it->second.period;
+                  while (deadline <= now)
+                  {
+                       deadline += it->second.period;
+                       lateness.missed++;
+                  }
+                  Schedule(next.second, deadline);
+
+                  // Run the callback outside the lock
+                  function<void(void)> func = it->second.func;
+                  running_id = next.second;
+                  lock.unlock();
+
+                  func();
+
+                  lock.lock();
+                  running_id = 0;
+                  done_cv.notify_all();
+             }
+        }
+};
+
 //
 //***********************************************************************************************
 //
 // Class clock_timer: Timer class to process periodic sync message broadcast and statistics
+//                    (a handle on a timer of the shared clock_scheduler)
 //
 // Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
 //
@@ -21,18 +231,16 @@ class clock_timer
         // Declare atomic for state
 	atomic<bool> exec;
 
-        // Declare timer thread
-	thread oTimerThread;
-
-        // Declare mutex for timer firing
-	mutex timer_interval_mutex;
+        // Declare the scheduler and the id of this timer in it
+	clock_scheduler & scheduler;
+	uint64_t timer_id {0};
 
         // Declare timer interval
-	int timer_interval;
+	atomic<int> timer_interval;
 
 public:
 	// Constructor
-	clock_timer () : exec(false) {}
+	clock_timer (clock_scheduler & poScheduler = clock_scheduler::GetDefault()) : exec(false), scheduler(poScheduler), timer_interval(0) {}
 
 	// Destructor
 	~clock_timer()
@@ -47,82 +255,68 @@ public:
 	// Get the timer interval
 	int GetInterval()
 	{
-	    lock_guard<mutex> lock(timer_interval_mutex);
-	    return timer_interval;
+	    return timer_interval.load(memory_order_relaxed);
 	}
 
 	// Set the timer interval
 	void SetInterval(int piInterval)
 	{
-	     lock_guard<mutex> lock(timer_interval_mutex);
-	     timer_interval = piInterval;
+	     timer_interval.store(piInterval, memory_order_relaxed);
+
+	     if (exec.load(memory_order_acquire))
+	     {
+	         scheduler.SetInterval(timer_id, piInterval);
+	     }
 	}
 
 	// Increment the timer interval
 	void IncrementInterval(int piIntervalIncrement = 1)
 	{
-	     lock_guard<mutex> lock(timer_interval_mutex);
-	     timer_interval = (timer_interval + piIntervalIncrement);
+	     SetInterval(GetInterval() + piIntervalIncrement);
 	}
 
-	// Stop the timer 
+	// Stop the timer (the callback is not running once this returns)
 	void stop()
 	{
              // Release memory of atomic
-	     exec.store(false, memory_order_release);
-
-             // Join timer thread
-	     if (oTimerThread.joinable())
+	     if (exec.exchange(false, memory_order_acq_rel))
 	     {
-	         oTimerThread.join();
+	         scheduler.Cancel(timer_id);
 	     }
 	}
 
 	// Kill the timer
 	void kill()
 	{
-             // If memory acquired then stop
-	     if (exec.load(memory_order_acquire))
-	     {
-                 // Release memory of atomic
-	         exec.store(false, memory_order_release);
-             }		
+	     stop();
 	}
 
-	// Start the thread and callback for the specified milliseconds
+	// Start the timer and callback every specified milliseconds
 	void start(int pinterval, function<void(void)> func)
 	{
-	      // Set the interval as input
-	      SetInterval(pinterval);
-
               // Stop timer if already acquired
 	      if (exec.load(memory_order_acquire))
 	      {
 		  stop();
 	      }
 
-              // Set the atomic to proceed to lauch timer thread
-	      exec.store(true, memory_order_release);
+	      // Set the interval as input
+	      timer_interval.store(pinterval, memory_order_relaxed);
 
-              // Launch timer thread
-	      oTimerThread = thread
-	      (
-		   [this, func]()
-	           {
-			while (true)
-			{
-                                // Sleep for interval then invoke callback
-				this_thread::sleep_for(chrono::milliseconds(GetInterval()));
-
-				func();
-			}
-		   }
-	      );
+              // Schedule the timer
+	      timer_id = scheduler.Add(pinterval, func);
+	      exec.store(true, memory_order_release);
 	}
 
-	// Check if timer thread is running
+	// Check if timer is running
 	bool is_running() const noexcept
 	{
-	     return (exec.load(memory_order_acquire) && oTimerThread.joinable());
+	     return exec.load(memory_order_acquire);
+	}
+
+	// Get the lateness statistics of the timer ticks
+	ClockTimerLateness GetLateness()
+	{
+	     return scheduler.GetLateness(timer_id);
 	}
 };
@@ -1,9 +1,27 @@
 #include <iostream>
 #include <string>
+#include <sstream>
 #include <chrono>
 #include <iomanip>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#if defined UNIX
+#include <time.h>
+#endif
+
+#if defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#define CLOCK_TIME_TSC
+#endif
+
+#include "clock_checksum.hpp"
 
 using namespace std;
 //
@@ -15,69 +33,589 @@ using namespace std;
 //
 //***********************************************************************************************
 //
-// Synchronization message
+// Synchronization message (NTP style: server transmit, client receive and client transmit times,
+// in nanoseconds since epoch)
 struct ClockSyncMessage 
 {
-      uint32_t clock_id; // or client_id
-      uint64_t server_ts;
-      uint64_t client_ts;
-      uint16_t checksum;
+      uint32_t clock_id;     // or client_id
+      uint64_t server_ts;    // server transmit time (T1)
+      uint64_t client_ts;    // client receive time (T2)
+      uint64_t client_tx_ts; // client transmit time (T3)
+      uint32_t server_id {0}; // server clock answered by a reply (0 in broadcasts and legacy replies)
+      uint32_t reply_window {0}; // window over which clients spread their replies to a broadcast (microseconds, 0 at once)
+      uint32_t sequence {0};  // broadcast round (echoed by replies; 0 when not numbered)
+      uint32_t checksum {0};  // checksum of the frame (set by the encoder and the decoder)
+      ClockCheckSumKind checksum_kind {CHECKSUM_CRC32C};
+      bool checksum_valid {false}; // the received frame matched its checksum (set by the decoder)
+};
+
+// Lateness of periodic timer ticks (scheduling jitter)
+struct ClockTimerLateness
+{
+      uint64_t ticks    {0};   // ticks fired
+      uint64_t missed   {0};   // ticks skipped because a previous one ran too late
+      int64_t  last_us  {0};   // lateness of the last tick
+      int64_t  max_us   {0};   // maximum lateness
+      double   total_us {0.0}; // cumulative lateness (for the mean)
+};
+
+// Edit of timer lateness for tracking scheduling jitter
+string FormatLateness (ClockTimerLateness const & poLateness)
+{
+       ostringstream ostring;
+       ostring << "ticks [" << poLateness.ticks << "] missed [" << poLateness.missed << "] late us last [" << poLateness.last_us
+               << "] mean [" << (poLateness.ticks > 0 ? static_cast<int64_t>(poLateness.total_us / poLateness.ticks) : 0)
+               << "] max [" << poLateness.max_us << "]";
+       return ostring.str();
+}
+
+// Time stamp sources (all read as nanoseconds since epoch)
+enum ClockTimeSource
+{
+     TIME_REALTIME      = 0,  // CLOCK_REALTIME (follows the steps and slews of the wall clock)
+     TIME_MONOTONIC_RAW = 1,  // CLOCK_MONOTONIC_RAW anchored to the realtime clock when selected
+     TIME_TSC           = 2   // invariant time stamp counter calibrated against CLOCK_MONOTONIC_RAW
+};
+
+// Get the name of a time source
+const char* GetTimeSourceName (ClockTimeSource pSource)
+{
+     switch (pSource)
+     {
+          case TIME_REALTIME:      return "realtime";
+          case TIME_MONOTONIC_RAW: return "monotonic-raw";
+          case TIME_TSC:           return "tsc";
+     }
+
+     return "unknown";
+}
+
+// Parse the name of a time source (false if unknown)
+bool ParseTimeSourceName (string const & psName, ClockTimeSource & pSource)
+{
+     for (ClockTimeSource source : {TIME_REALTIME, TIME_MONOTONIC_RAW, TIME_TSC})
+     {
+          if (psName == GetTimeSourceName(source))
+          {
+              pSource = source;
+              return true;
+          }
+     }
+
+     return false;
+}
+
+//
+//***********************************************************************************************
+//
+// Class clock_time_source: Process wide source of the time stamps. The anchored sources are
+//                          set to the realtime clock once, when selected, and then run free:
+//                          wall clock steps and NTP slews during a measurement do not reach them,
+//                          and the TSC source reads the counter without entering the kernel.
+//                          Select the source at start up, before other threads read the time.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_time_source
+{
+        // Declare the selected source
+        ClockTimeSource source {TIME_REALTIME};
+
+        // Declare the anchor: realtime (ns since epoch) at a reading of the raw clock (ns or ticks)
+        uint64_t anchor_ns {0};
+        uint64_t anchor_raw {0};
+
+        // Declare the TSC rate (nanoseconds per tick, 32.32 fixed point)
+        uint64_t tsc_scale {0};
+
+        // Declare the TSC calibration interval (milliseconds)
+        enum { calibration_ms = 50 };
+
+public:
+
+        // Get the time source of the process
+        static clock_time_source & GetTimeSource ()
+        {
+             static clock_time_source time_source;
+             return time_source;
+        }
+
+        // Get the selected source
+        ClockTimeSource GetSource () const { return source; }
+
+        // Select a source (the TSC falls back to the raw monotonic clock when not invariant)
+        void Select (ClockTimeSource pSource)
+        {
+             if (pSource == TIME_TSC && !HasInvariantTSC())
+             {
+                 cerr << "Time stamp counter not invariant, using " << GetTimeSourceName(TIME_MONOTONIC_RAW) << endl;
+                 pSource = TIME_MONOTONIC_RAW;
+             }
+
+             if (pSource == TIME_MONOTONIC_RAW)
+             {
+                 Anchor(ReadMonotonicRaw);
+             }
+             else if (pSource == TIME_TSC)
+             {
+                 Calibrate();
+             }
+
+             source = pSource;
+        }
+
+        // Get the current time (nanoseconds since epoch)
+        uint64_t Now () const
+        {
+             switch (source)
+             {
+                  case TIME_MONOTONIC_RAW: return anchor_ns + (ReadMonotonicRaw() - anchor_raw);
+                  case TIME_TSC:           return anchor_ns + ScaleTicks(ReadTSC() - anchor_raw);
+                  default:                 return ReadRealtime();
+             }
+        }
+
+        // Get the difference of the source and the realtime clock (to convert kernel time stamps)
+        int64_t GetRealtimeDifference () const
+        {
+             return source == TIME_REALTIME ? 0 : static_cast<int64_t>(Now() - ReadRealtime());
+        }
+
+        // Read the realtime clock (nanoseconds since epoch)
+        static uint64_t ReadRealtime ()
+        {
+             return chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        // Read the raw monotonic clock (nanoseconds, not slewed; steady clock where unavailable)
+        static uint64_t ReadMonotonicRaw ()
+        {
+#if defined UNIX && defined CLOCK_MONOTONIC_RAW
+             struct timespec ts;
+             clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+             return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#else
+             return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+
+        // Read the time stamp counter (ticks)
+        static uint64_t ReadTSC ()
+        {
+#if defined CLOCK_TIME_TSC
+             return __rdtsc();
+#else
+             return 0;
+#endif
+        }
+
+        // Check if the time stamp counter runs at a constant rate in every power state
+        static bool HasInvariantTSC ()
+        {
+#if defined CLOCK_TIME_TSC
+             unsigned int eax, ebx, ecx, edx;
+             return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8)) != 0;
+#else
+             return false;
+#endif
+        }
+
+private:
+
+        // Anchor a raw clock to the realtime clock
+        void Anchor (uint64_t (*pReadRaw)())
+        {
+             anchor_raw = ReadPair(pReadRaw, ReadRealtime, anchor_ns);
+        }
+
+        // Measure the TSC rate against the raw monotonic clock, then anchor the counter
+        void Calibrate ()
+        {
+             uint64_t raw_start {0}, raw_end {0};
+             uint64_t tsc_start = ReadPair(ReadTSC, ReadMonotonicRaw, raw_start);
+
+             this_thread::sleep_for(chrono::milliseconds(calibration_ms));
+
+             uint64_t tsc_end = ReadPair(ReadTSC, ReadMonotonicRaw, raw_end);
+
+             tsc_scale = ((raw_end - raw_start) << 32) / max<uint64_t>(tsc_end - tsc_start, 1);
+             Anchor(ReadTSC);
+        }
+
+        // Read a reference clock between two readings of a raw clock; returns the raw reading at the
+        // reference one (the closest pair of a few tries, so a preempted try does not count)
+        static uint64_t ReadPair (uint64_t (*pReadRaw)(), uint64_t (*pReadReference)(), uint64_t & poReference)
+        {
+             uint64_t best {UINT64_MAX};
+             uint64_t raw {0};
+
+             for (int i=0; i<16; i++)
+             {
+                  uint64_t before    = pReadRaw();
+                  uint64_t reference = pReadReference();
+                  uint64_t after     = pReadRaw();
+
+                  if (after - before < best)
+                  {
+                      best        = after - before;
+                      raw         = before + (after - before) / 2;
+                      poReference = reference;
+                  }
+             }
+
+             return raw;
+        }
+
+        // Convert TSC ticks to nanoseconds
+        uint64_t ScaleTicks (uint64_t piTicks) const
+        {
+             __extension__ typedef unsigned __int128 uint128;
+             return static_cast<uint64_t>((static_cast<uint128>(piTicks) * tsc_scale) >> 32);
+        }
 };
 
+// Select the time source of the process by name (false if unknown)
+bool SelectTimeSource (string const & psName)
+{
+     ClockTimeSource source {TIME_REALTIME};
+     if (!ParseTimeSourceName(psName, source))
+     {
+         cerr << "\nUnknown time source [" << psName << "]: realtime, monotonic-raw or tsc\n";
+         return false;
+     }
+
+     clock_time_source::GetTimeSource().Select(source);
+     return true;
+}
+
+// Get the current time (in nanoseconds since epoch) from the selected time source
+uint64_t GetCurrentTime_ns (void) { return clock_time_source::GetTimeSource().Now(); }
+
 // Get the current time (in microseconds) since epoch
-uint64_t GetCurrentTimeSinceEpoch (void) { return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count(); }
-
-// Computation of checksum for synchronization message
-int16_t ComputeCheckSum (ClockSyncMessage const &poMsg)
-{
-       // Declare checksum to be computed
-       uint16_t checksum {0};
-
-       // If non zero, cummulative byte add (clockid) 
-       if (poMsg.clock_id != 0) 
-       {
-           for (unsigned i=0; i<sizeof(poMsg.clock_id); i++) 
-           {
-                checksum += ((poMsg.clock_id >> i * 8) & 0x000000ff);
-           }
-       }
-
-       // If non zero, cummulative byte add (server_ts) 
-       if (poMsg.server_ts != 0)
-       {
-           for (unsigned i=0; i<sizeof(poMsg.server_ts); i++) 
-           {
-                checksum += ((poMsg.server_ts >> i * 8) & 0x00000000000000ff);
-           }
-       }
-
-       // If non zero, cummulative byte add (client_ts) 
-       if (poMsg.client_ts != 0) 
-       {
-           for (unsigned i=0; i<sizeof(poMsg.client_ts); i++) 
-           {
-                checksum += ((poMsg.client_ts >> i * 8) & 0x00000000000000ff);
-           }
-       }
-
-       return checksum;
-}
-
-// Validate message checksum (to check for packets integrity under udp, etc.)
+uint64_t GetCurrentTimeSinceEpoch (void) { return GetCurrentTime_ns() / 1000; }
+
+// Round a duration in nanoseconds to microseconds (to the nearest, halves away from zero)
+int64_t RoundToMicroseconds (int64_t piDuration_ns)
+{
+     return (piDuration_ns >= 0 ? piDuration_ns + 500 : piDuration_ns - 500) / 1000;
+}
+
+// Get the reply slot of a client within a reply window (microseconds after the broadcast). The slot is
+// deterministic per client and the multiplicative hash spreads consecutive client ids evenly over the window
+uint32_t GetReplySlot (uint32_t pClientID, uint32_t pReplyWindow_us)
+{
+     return static_cast<uint32_t>((static_cast<uint64_t>(pClientID * 0x9e3779b1u) * pReplyWindow_us) >> 32);
+}
+
+// Format a time (in microseconds since epoch) as a local datetime edit with microsecond precision
+string FormatEpochTime_us (uint64_t micSecondsSinceEpoch)
+{
+       // Get time after duration
+       time_t time_after_duration = static_cast<time_t>(micSecondsSinceEpoch / 1000000);
+
+       // Calculate remainder in microseconds
+       long long int micseconds_remainder = micSecondsSinceEpoch % 1000000;
+
+       // Build date edit
+       ostringstream ostring;
+       ostring << put_time(localtime(&time_after_duration), "%Y-%m-%d %H:%M:%S.") << micseconds_remainder;
+
+       // Return edit date with microsecond precision
+       return ostring.str();
+}
+
+// Client transmit time of a reply (the receive time if the client did not stamp it)
+uint64_t GetClientTransmitTime (ClockSyncMessage const &poMsg)
+{
+     return poMsg.client_tx_ts != 0 ? poMsg.client_tx_ts : poMsg.client_ts;
+}
+
+// Compute the offset (server minus client, nanoseconds) of a reply received at pFinalTimeStamp (T4):
+// ((T1 - T2) + (T4 - T3)) / 2, so the client processing time (T3 - T2) cancels out
+int64_t ComputeOffset (ClockSyncMessage const &poMsg, uint64_t pFinalTimeStamp)
+{
+     int64_t outbound = static_cast<int64_t>(poMsg.server_ts - poMsg.client_ts);
+     int64_t inbound  = static_cast<int64_t>(pFinalTimeStamp - GetClientTransmitTime(poMsg));
+     return (outbound + inbound) / 2;
+}
+
+// Compute the round-trip delay (nanoseconds) of a reply received at pFinalTimeStamp (T4): (T4 - T1) - (T3 - T2)
+int64_t ComputeDelay (ClockSyncMessage const &poMsg, uint64_t pFinalTimeStamp)
+{
+     return static_cast<int64_t>(pFinalTimeStamp - poMsg.server_ts) - static_cast<int64_t>(GetClientTransmitTime(poMsg) - poMsg.client_ts);
+}
+
+// Validate message checksum (to check for packets integrity under udp, etc.; computed by the decoder
+// over the received frame)
 bool ValidateCheckSum(ClockSyncMessage const &poMsg) 
 {
-     return poMsg.checksum == ComputeCheckSum(poMsg);
+     return poMsg.checksum_valid;
 }
 
-// Print Sync Message for tracking content
+// Get the value of a command line option given as "--name value" or "--name=value" (or the default)
+string GetCommandOption(int argc, char* argv[], string const & psOption, string const & psDefault = "")
+{
+     for (int i=1; i<argc; i++)
+     {
+          string sArg (argv[i]);
+
+          // Option followed by its value as the next argument
+          if (sArg == psOption && i+1 < argc)
+          {
+              return argv[i+1];
+          }
+
+          // Option with its value attached
+          if (sArg.compare(0, psOption.size()+1, psOption + "=") == 0)
+          {
+              return sArg.substr(psOption.size()+1);
+          }
+     }
+
+     return psDefault;
+}
+
+// Split a comma separated list of numbers (e.g. clock ids)
+vector<uint32_t> ParseList (string const & psList)
+{
+     vector<uint32_t> values;
+     istringstream istring (psList);
+     string item;
+
+     while (getline(istring, item, ','))
+     {
+          if (!item.empty())
+          {
+              values.push_back(strtoul(item.c_str(), NULL, 10));
+          }
+     }
+
+     return values;
+}
+
+// Check if a command line flag (option without value) has been specified
+bool HasCommandOption(int argc, char* argv[], string const & psOption)
+{
+     for (int i=1; i<argc; i++)
+     {
+          if (psOption == argv[i])
+          {
+              return true;
+          }
+     }
+
+     return false;
+}
+
+// Format Sync Message for tracking content
+string FormatSyncMessage(string const & psLegend, ClockSyncMessage const & poMsg)
+{
+     char line[160];
+     snprintf(line, sizeof(line), "\n%s: clock_id [0x%08x] client_ts [0x%016llx] server_ts [0x%016llx] checksum [0x%08x]\n",
+              psLegend.c_str(), poMsg.clock_id, static_cast<unsigned long long>(poMsg.client_ts), static_cast<unsigned long long>(poMsg.server_ts), poMsg.checksum);
+     return line;
+}
+
+// Print Sync Message for tracking content (one write per message)
 void PrintSyncMessage(string psLegend, ClockSyncMessage const & poMsg) 
 {
-     mutex mx;
-     lock_guard<mutex> lck(mx);
+     cerr << FormatSyncMessage(psLegend, poMsg) << flush;
+}
+
+// Trace events recorded by the hot paths (rendered by the trace decoder)
+enum ClockTraceEvent : uint32_t 
+{
+     TRACE_BUILT,   // "BUILT"
+     TRACE_PROCD    // "PROCD(<count>)"
+};
+
+// Trace verbosity levels
+enum ClockTraceLevel 
+{
+     TRACE_OFF       = 0,  // nothing traced
+     TRACE_BROADCAST = 1,  // broadcast messages
+     TRACE_MESSAGES  = 2   // broadcast and every processed reply
+};
+
+//
+//***********************************************************************************************
+//
+// Class clock_trace: Lock-free ring of fixed-size binary trace records. Hot paths only copy a
+//                    record into the ring (dropping it if full); a background decoder thread
+//                    renders the records in the PrintSyncMessage text format to stderr.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_trace
+{
+        // Declare a trace record (cell sequence arbitrates producers and the decoder)
+        struct clock_trace_record
+        {
+               atomic<size_t> sequence;
+               uint32_t event;
+               uint64_t argument;
+               ClockSyncMessage msg;
+        };
+
+        // Declare number of records in the ring (power of two)
+        enum { ring_size = 4096 };
+
+        // Declare the ring and its positions
+        unique_ptr<clock_trace_record[]> ring;
+        atomic<size_t> enqueue_pos;
+        size_t dequeue_pos {0};
+
+        // Declare the verbosity level and the number of records dropped
+        atomic<int> level;
+        atomic<uint64_t> dropped;
+
+        // Declare the state and the decoder thread
+        atomic<bool> exec;
+        thread oDecoderThread;
+
+public:
+
+        // Constructor (verbosity from the CLOCK_TRACE environment variable, default broadcasts only)
+        clock_trace () : ring(new clock_trace_record[ring_size]), enqueue_pos(0), level(TRACE_BROADCAST), dropped(0), exec(true)
+        {
+             for (size_t i=0; i<ring_size; i++)
+             {
+                  ring[i].sequence.store(i, memory_order_relaxed);
+             }
+
+             const char* sLevel = getenv("CLOCK_TRACE");
+             if (sLevel != NULL)
+             {
+                 level.store(atoi(sLevel), memory_order_relaxed);
+             }
+
+             oDecoderThread = thread(&clock_trace::DecoderLoop, this);
+        }
+
+        // Destructor
+        ~clock_trace ()
+        {
+             exec.store(false, memory_order_release);
+
+             if (oDecoderThread.joinable())
+             {
+                 oDecoderThread.join();
+             }
+        }
+
+        // Get the process wide trace
+        static clock_trace & GetTrace ()
+        {
+             static clock_trace trace;
+             return trace;
+        }
+
+        // Get and set the verbosity level
+        int  GetLevel () const { return level.load(memory_order_relaxed); }
+        void SetLevel (int piLevel) { level.store(piLevel, memory_order_relaxed); }
+
+        // Get the number of records dropped because the ring was full
+        uint64_t GetDropped () const { return dropped.load(memory_order_relaxed); }
+
+        // Record a sync message (lock-free, multiple producers); returns false if dropped
+        bool Record (ClockTraceEvent pEvent, uint64_t pArgument, ClockSyncMessage const & poMsg)
+        {
+             size_t pos = enqueue_pos.load(memory_order_relaxed);
+
+             while (true)
+             {
+                  clock_trace_record & cell = ring[pos & (ring_size - 1)];
+                  intptr_t diff = static_cast<intptr_t>(cell.sequence.load(memory_order_acquire)) - static_cast<intptr_t>(pos);
+
+                  // The cell is free: claim it
+                  if (diff == 0)
+                  {
+                      if (enqueue_pos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                      {
+                          cell.event    = pEvent;
+                          cell.argument = pArgument;
+                          cell.msg      = poMsg;
+                          cell.sequence.store(pos + 1, memory_order_release);
+                          return true;
+                      }
+                  }
+                  // The ring is full
+                  else if (diff < 0)
+                  {
+                      dropped.fetch_add(1, memory_order_relaxed);
+                      return false;
+                  }
+                  else
+                  {
+                      pos = enqueue_pos.load(memory_order_relaxed);
+                  }
+             }
+        }
+
+private:
+
+        // Render a trace record in the PrintSyncMessage text format
+        static string Decode (clock_trace_record const & poRecord)
+        {
+             switch (poRecord.event)
+             {
+                 case TRACE_BUILT: return FormatSyncMessage("BUILT", poRecord.msg);
+                 case TRACE_PROCD: return FormatSyncMessage("PROCD(" + to_string(poRecord.argument) + ")", poRecord.msg);
+             }
+
+             return FormatSyncMessage("TRACE(" + to_string(poRecord.event) + ")", poRecord.msg);
+        }
+
+        // Decoder loop: render pending records with one write per batch
+        void DecoderLoop ()
+        {
+             string sText;
+
+             while (true)
+             {
+                  bool running = exec.load(memory_order_acquire);
+
+                  // Render every published record
+                  while (true)
+                  {
+                       clock_trace_record & cell = ring[dequeue_pos & (ring_size - 1)];
+                       if (cell.sequence.load(memory_order_acquire) != dequeue_pos + 1)
+                       {
+                           break;
+                       }
+
+                       sText += Decode(cell);
+                       cell.sequence.store(dequeue_pos + ring_size, memory_order_release);
+                       dequeue_pos++;
+                  }
+
+                  if (!sText.empty())
+                  {
+                      cerr << sText << flush;
+                      sText.clear();
+                  }
+
+                  if (!running)
+                  {
+                      break;
+                  }
+
+                  this_thread::sleep_for(chrono::milliseconds(20));
+             }
+        }
+};
+
+// Record a sync message in the trace if the verbosity level allows it (no locks, no formatting)
+void TraceSyncMessage(int piLevel, ClockTraceEvent pEvent, uint64_t pArgument, ClockSyncMessage const & poMsg)
+{
+     clock_trace & trace = clock_trace::GetTrace();
 
-     cerr << hex << setfill('0') << "\n" << psLegend << ": clock_id [0x"
-		 << setw(8) << poMsg.clock_id <<  "] client_ts [0x"
-		 << setw(16) << poMsg.client_ts << "] server_ts [0x"
-		 << setw(16) << poMsg.server_ts << "] checksum [0x"
-		 << setw(4) << poMsg.checksum <<  "]" << dec << endl;
+     if (trace.GetLevel() >= piLevel)
+     {
+         trace.Record(pEvent, pArgument, poMsg);
+     }
 }
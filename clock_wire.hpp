@@ -0,0 +1,195 @@
+#include <cstring>
+#include <cstddef>
+#include <string>
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// Wire format of ClockSyncMessage: packed, explicitly little-endian frames with a magic and
+// version header, independent of the host struct layout, padding and byte order. The checksum
+// (of the kind in the flags) covers the whole body, from offset 12 to the frame length.
+//
+//   offset  size  field
+//        0     2  magic (0x4b43, "CK" on the wire)
+//        2     1  version
+//        3     1  flags (bits 0-1: checksum kind)
+//        4     2  frame length (header and body; later versions only append fields)
+//        6     2  reserved (zero)
+//        8     4  checksum
+//       12     4  clock_id
+//       16     8  server_ts (nanoseconds since epoch)
+//       24     8  client_ts (nanoseconds since epoch)
+//       32     8  client_tx_ts (nanoseconds since epoch)
+//       40     4  server_id (server clock a reply answers, 0 in broadcasts)
+//       44     4  reply_window (microseconds over which clients spread their replies, 0 at once)
+//       48     4  sequence (broadcast round, numbered from 1 per server clock; echoed by replies)
+//       52     4  reserved (zero)
+//
+// Legacy frames (the raw 32-byte host struct of x86-64 builds: clock_id, server_ts, client_ts
+// in microseconds, 16-bit byte sum of those fields) are still decoded when compatibility is enabled, and can be
+// encoded for old peers.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+// Wire formats
+enum ClockWireFormat
+{
+     WIRE_LEGACY  = 0,  // raw 32-byte host struct of the original release
+     WIRE_CURRENT = 1   // packed little-endian frame with header
+};
+
+// Wire constants
+const uint16_t clock_wire_magic {0x4b43};
+const uint8_t  clock_wire_version {WIRE_CURRENT};
+const size_t   clock_wire_length {56};
+const size_t   clock_wire_legacy_length {32};
+const size_t   clock_wire_body_offset {12};
+const uint8_t  clock_wire_checksum_mask {0x03};
+
+// Get the name of a wire format
+const char* GetWireFormatName (ClockWireFormat pFormat)
+{
+     switch (pFormat)
+     {
+          case WIRE_LEGACY:  return "legacy";
+          case WIRE_CURRENT: return "current";
+     }
+
+     return "unknown";
+}
+
+// Parse the name of a wire format (false if unknown)
+bool ParseWireFormatName (string const & psName, ClockWireFormat & pFormat)
+{
+     for (ClockWireFormat format : {WIRE_LEGACY, WIRE_CURRENT})
+     {
+          if (psName == GetWireFormatName(format))
+          {
+              pFormat = format;
+              return true;
+          }
+     }
+
+     return false;
+}
+
+// Get the frame length of a wire format
+size_t GetWireLength (ClockWireFormat pFormat)
+{
+     return pFormat == WIRE_LEGACY ? clock_wire_legacy_length : clock_wire_length;
+}
+
+// Get the byte sum of the fields of a legacy frame (the struct padding is not covered)
+uint16_t GetLegacyCheckSum (const unsigned char* p)
+{
+     return static_cast<uint16_t>(ComputeByteSum(p, 4) + ComputeByteSum(p + 8, 16));
+}
+
+// Encode a sync message into a buffer, setting the checksum of the frame in the message; returns the
+// frame length (0 if the buffer is too small)
+size_t EncodeSyncMessage (ClockSyncMessage & poMsg, char* pBuffer, size_t pLength, ClockWireFormat pFormat = WIRE_CURRENT)
+{
+     unsigned char* p = reinterpret_cast<unsigned char*>(pBuffer);
+
+     size_t frame_length = GetWireLength(pFormat);
+     if (pLength < frame_length)
+     {
+         return 0;
+     }
+
+     // Legacy frame: the original struct layout (little-endian, zero padding) with the original byte
+     // sum of its fields (no client transmit time, microsecond time stamps)
+     if (pFormat == WIRE_LEGACY)
+     {
+         memset(p, 0, clock_wire_legacy_length);
+         StoreLE32(p +  0, poMsg.clock_id);
+         StoreLE64(p +  8, poMsg.server_ts / 1000);
+         StoreLE64(p + 16, poMsg.client_ts / 1000);
+
+         poMsg.checksum = GetLegacyCheckSum(p);
+         StoreLE16(p + 24, poMsg.checksum);
+         return clock_wire_legacy_length;
+     }
+
+     // Header
+     StoreLE16(p + 0, clock_wire_magic);
+     p[2] = clock_wire_version;
+     p[3] = poMsg.checksum_kind & clock_wire_checksum_mask;
+     StoreLE16(p + 4, clock_wire_length);
+     StoreLE16(p + 6, 0);
+
+     // Body
+     StoreLE32(p + 12, poMsg.clock_id);
+     StoreLE64(p + 16, poMsg.server_ts);
+     StoreLE64(p + 24, poMsg.client_ts);
+     StoreLE64(p + 32, poMsg.client_tx_ts);
+     StoreLE32(p + 40, poMsg.server_id);
+     StoreLE32(p + 44, poMsg.reply_window);
+     StoreLE32(p + 48, poMsg.sequence);
+     StoreLE32(p + 52, 0);
+
+     // Checksum of the body
+     poMsg.checksum = ComputeCheckSum(poMsg.checksum_kind, p + clock_wire_body_offset, clock_wire_length - clock_wire_body_offset);
+     StoreLE32(p + 8, poMsg.checksum);
+
+     return clock_wire_length;
+}
+
+// Decode a received frame into a sync message (format reported in pFormat); false if not a valid frame
+bool DecodeSyncMessage (const char* pBuffer, size_t pLength, ClockSyncMessage & poMsg, ClockWireFormat & pFormat, bool pAcceptLegacy = true)
+{
+     const unsigned char* p = reinterpret_cast<const unsigned char*>(pBuffer);
+
+     // Versioned frame: accept any later version that keeps the fields in place
+     if (pLength >= clock_wire_length && LoadLE16(p) == clock_wire_magic && p[2] >= clock_wire_version)
+     {
+         size_t frame_length = LoadLE16(p + 4);
+         uint8_t checksum_kind = p[3] & clock_wire_checksum_mask;
+         if (frame_length < clock_wire_length || frame_length > pLength || checksum_kind == CHECKSUM_BYTESUM || checksum_kind > CHECKSUM_CRC32C)
+         {
+             return false;
+         }
+
+         poMsg.checksum_kind = static_cast<ClockCheckSumKind>(checksum_kind);
+         poMsg.checksum     = LoadLE32(p + 8);
+         poMsg.clock_id     = LoadLE32(p + 12);
+         poMsg.server_ts    = LoadLE64(p + 16);
+         poMsg.client_ts    = LoadLE64(p + 24);
+         poMsg.client_tx_ts = LoadLE64(p + 32);
+         poMsg.server_id    = LoadLE32(p + 40);
+         poMsg.reply_window = LoadLE32(p + 44);
+         poMsg.sequence     = LoadLE32(p + 48);
+         poMsg.checksum_valid = ComputeCheckSum(poMsg.checksum_kind, p + clock_wire_body_offset, frame_length - clock_wire_body_offset) == poMsg.checksum;
+         pFormat = WIRE_CURRENT;
+         return true;
+     }
+
+     // Legacy frame (no client transmit time)
+     if (pAcceptLegacy && pLength == clock_wire_legacy_length)
+     {
+         poMsg.clock_id     = LoadLE32(p +  0);
+         poMsg.server_ts    = LoadLE64(p +  8) * 1000;
+         poMsg.client_ts    = LoadLE64(p + 16) * 1000;
+         poMsg.client_tx_ts = 0;
+         poMsg.server_id    = 0;
+         poMsg.reply_window = 0;
+         poMsg.sequence     = 0;
+         poMsg.checksum     = LoadLE16(p + 24);
+         poMsg.checksum_kind = CHECKSUM_BYTESUM;
+         poMsg.checksum_valid = GetLegacyCheckSum(p) == poMsg.checksum;
+         pFormat = WIRE_LEGACY;
+         return true;
+     }
+
+     return false;
+}
+
+// Decode a received frame into a sync message; false if not a valid frame
+bool DecodeSyncMessage (const char* pBuffer, size_t pLength, ClockSyncMessage & poMsg, bool pAcceptLegacy = true)
+{
+     ClockWireFormat format;
+     return DecodeSyncMessage(pBuffer, pLength, poMsg, format, pAcceptLegacy);
+}
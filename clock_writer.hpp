@@ -0,0 +1,249 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+#if defined UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+using namespace std;
+//
+//***********************************************************************************************
+//
+// Class clock_writer: Background writer appending period records to a file. Records are handed
+//                     over through a lock-free single producer/single consumer ring and written
+//                     with one buffered write per record; fsync follows a configurable policy.
+//
+// Ernesto L Aparcedo, Ph.D. (c) 2019 - All Rights Reserved.
+//
+//***********************************************************************************************
+//
+class clock_writer
+{
+        // Declare a pending record and the file it is appended to
+        struct clock_record
+        {
+               string file;
+               string data;
+        };
+
+        // Declare number of records that may wait in the ring (power of two)
+        enum { ring_size = 256 };
+
+        // Declare file to which records are appended (by default)
+        string file_name;
+
+        // Declare fsync policy: -1 never, 0 after every record, N at most every N seconds
+        int fsync_interval;
+
+        // Declare the ring of pending records (head: next to write, tail: next free)
+        vector<clock_record> ring;
+        atomic<size_t> head;
+        atomic<size_t> tail;
+
+        // Declare the number of records dropped because the ring was full
+        atomic<uint64_t> dropped;
+
+        // Declare the state, wakeup and the writer thread
+        atomic<bool> exec;
+        mutex wake_mx;
+        condition_variable wake_cv;
+        thread oWriterThread;
+
+public:
+
+        // Constructor
+        clock_writer (string const & psFileName, int piFsyncInterval = -1) :
+
+                      file_name      (psFileName),
+                      fsync_interval (piFsyncInterval),
+                      ring           (ring_size),
+                      head           (0),
+                      tail           (0),
+                      dropped        (0),
+                      exec           (true)
+        {
+             // Launch writer thread
+             oWriterThread = thread(&clock_writer::WriterLoop, this);
+        }
+
+        // Destructor
+        ~clock_writer ()
+        {
+             // Stop the writer once the pending records are written
+             {
+                 lock_guard<mutex> lock(wake_mx);
+                 exec.store(false, memory_order_release);
+             }
+             wake_cv.notify_one();
+
+             if (oWriterThread.joinable())
+             {
+                 oWriterThread.join();
+             }
+        }
+
+        // Queue a record for writing to the default file (single producer); returns false if the ring is full
+        bool Write (string && psRecord)
+        {
+             return Write(move(psRecord), file_name);
+        }
+
+        // Queue a record for writing to a given file (single producer); returns false if the ring is full
+        bool Write (string && psRecord, string const & psFileName)
+        {
+             size_t t = tail.load(memory_order_relaxed);
+
+             if (t - head.load(memory_order_acquire) >= ring_size)
+             {
+                 dropped.fetch_add(1, memory_order_relaxed);
+                 clock_metrics::Add(METRIC_WRITER_DROPS);
+                 cerr << "Error Writer queue full, record dropped [" << psFileName << "]" << endl;
+                 return false;
+             }
+
+             ring[t & (ring_size - 1)].file = psFileName;
+             ring[t & (ring_size - 1)].data = move(psRecord);
+             tail.store(t + 1, memory_order_release);
+
+             // Wake up the writer
+             {
+                 lock_guard<mutex> lock(wake_mx);
+             }
+             wake_cv.notify_one();
+
+             return true;
+        }
+
+        // Get the number of records dropped
+        uint64_t GetDropped () const { return dropped.load(memory_order_relaxed); }
+
+private:
+
+        // Writer loop: drain the ring, then sleep until new records arrive
+        void WriterLoop ()
+        {
+             auto last_sync = chrono::steady_clock::now();
+             vector<string> unsynced;
+
+             while (true)
+             {
+                  // Write every pending record
+                  size_t h = head.load(memory_order_relaxed);
+                  while (h != tail.load(memory_order_acquire))
+                  {
+                       clock_record & record = ring[h & (ring_size - 1)];
+                       {
+                           clock_metrics_scope timing (LATENCY_WRITE);
+                           Append(record.file, record.data, fsync_interval == 0);
+                       }
+                       if (fsync_interval > 0 && find(unsynced.begin(), unsynced.end(), record.file) == unsynced.end())
+                       {
+                           unsynced.push_back(record.file);
+                       }
+
+                       record.data.clear();
+                       record.data.shrink_to_fit();
+
+                       head.store(++h, memory_order_release);
+                  }
+
+                  // Sync on the timed policy
+                  if (!unsynced.empty() && chrono::steady_clock::now() - last_sync >= chrono::seconds(fsync_interval))
+                  {
+                      for (auto & file : unsynced)
+                      {
+                           Sync(file);
+                      }
+
+                      last_sync = chrono::steady_clock::now();
+                      unsynced.clear();
+                  }
+
+                  // Wait for more records (or stop once drained)
+                  unique_lock<mutex> lock(wake_mx);
+                  if (!exec.load(memory_order_acquire) && head.load(memory_order_relaxed) == tail.load(memory_order_acquire))
+                  {
+                      break;
+                  }
+
+                  wake_cv.wait_for(lock, chrono::seconds(1), [this] { return !exec.load(memory_order_acquire) || head.load(memory_order_relaxed) != tail.load(memory_order_acquire); });
+             }
+
+             // Flush what is left under the timed policy
+             for (auto & file : unsynced)
+             {
+                  Sync(file);
+             }
+        }
+
+#if defined UNIX
+        // Append a record with a single write (and fsync if requested)
+        void Append (string const & psFileName, string const & psRecord, bool pSync)
+        {
+             int fd = open(psFileName.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+             if (fd < 0)
+             {
+                 cerr << "Error Opening output file [" << psFileName << "]" << endl;
+                 return;
+             }
+
+             size_t written {0};
+             while (written < psRecord.size())
+             {
+                  ssize_t n = write(fd, psRecord.data() + written, psRecord.size() - written);
+                  if (n < 0)
+                  {
+                      if (errno == EINTR)
+                      {
+                          continue;
+                      }
+
+                      cerr << "Error Writing output file [" << psFileName << "]" << endl;
+                      break;
+                  }
+
+                  written += n;
+             }
+
+             if (pSync)
+             {
+                 fsync(fd);
+             }
+
+             close(fd);
+        }
+
+        // Flush the file to stable storage
+        void Sync (string const & psFileName)
+        {
+             int fd = open(psFileName.c_str(), O_WRONLY | O_CLOEXEC);
+             if (fd > -1)
+             {
+                 fsync(fd);
+                 close(fd);
+             }
+        }
+#else
+        // Append a record with a single buffered write
+        void Append (string const & psFileName, string const & psRecord, bool)
+        {
+             ofstream out_file (psFileName, ofstream::out | ofstream::app | ofstream::binary);
+             out_file.write(psRecord.data(), psRecord.size());
+        }
+
+        // Flush the file (the stream is flushed on close)
+        void Sync (string const &)
+        {
+        }
+#endif
+};